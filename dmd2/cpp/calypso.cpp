@@ -22,6 +22,7 @@
 #include "clang/AST/DeclTemplate.h"
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Basic/SourceManager.h"
+#include "clang/Basic/Version.h"
 #include "clang/Driver/Compilation.h"
 #include "clang/Driver/Driver.h"
 #include "clang/Driver/Tool.h"
@@ -39,10 +40,17 @@
 #include "clang/Serialization/ASTWriter.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/Option/ArgList.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/LockFileManager.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Program.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/IR/LLVMContext.h"
 
+#include <chrono>
+
 namespace cpp
 {
 
@@ -66,9 +74,7 @@ RootObject *SpecValue::toTemplateArg(Loc loc)
 
 Identifier *fromIdentifier(const clang::IdentifierInfo *II)
 {
-    return Identifier::idPool(II->getNameStart());
-        // NOTE: Every C++ identifier passing through DMD gets its own redundant copy in memory
-        // Is this the cost of interfacing with Clang or is there another way? (probably not an easy one)
+    return calypso.mapIdentifier(II).ident;
 }
 
 static const char *getOperatorName(const clang::OverloadedOperatorKind OO)
@@ -337,7 +343,8 @@ Identifier *getIdentifierOrNull(const clang::NamedDecl *D, SpecValue *spec, bool
     if (!II)
         return nullptr;
 
-    auto ident = fromIdentifier(II);
+    auto mappedII = calypso.mapIdentifier(II);
+    auto ident = mappedII.ident;
     bool needsPrefixing = false;
 
     auto ParentTag = dyn_cast<clang::TagDecl>(D->getDeclContext());
@@ -355,18 +362,8 @@ Identifier *getIdentifierOrNull(const clang::NamedDecl *D, SpecValue *spec, bool
         }
     }
 
-    if (isa<clang::RecordDecl>(D))
-    {
-        // Prefix reserved class names with '§'
-        if (ident == Id::Object || ident == Id::Throwable || ident == Id::Exception || ident == Id::Error ||
-            ident == Id::TypeInfo || ident == Id::TypeInfo_Class || ident == Id::TypeInfo_Interface ||
-            ident == Id::TypeInfo_Struct || ident == Id::TypeInfo_Pointer ||
-            ident == Id::TypeInfo_Array || ident == Id::TypeInfo_StaticArray || ident == Id::TypeInfo_AssociativeArray ||
-            ident == Id::TypeInfo_Enum || ident == Id::TypeInfo_Function || ident == Id::TypeInfo_Delegate ||
-            ident == Id::TypeInfo_Tuple || ident == Id::TypeInfo_Const || ident == Id::TypeInfo_Invariant ||
-            ident == Id::TypeInfo_Shared || ident == Id::TypeInfo_Wild || ident == Id::TypeInfo_Vector) // thanks C++...
-            needsPrefixing = true;
-    }
+    if (isa<clang::RecordDecl>(D) && mappedII.isReservedClassName)
+        needsPrefixing = true; // prefix reserved class names with '§'
 
     if (needsPrefixing)
     {
@@ -481,10 +478,18 @@ const char *LangPlugin::mangle(Dsymbol *s)
         return ::mangleImpl(s);
 
     auto ND = cast<clang::NamedDecl>(getDecl(s));
+    auto CanonND = getCanonicalDecl(ND);
+
+    auto &FoundStr = MangledDeclNames[CanonND];
+    if (FoundStr)
+        return FoundStr;
 
-    auto &FoundStr = MangledDeclNames[getCanonicalDecl(ND)];
-    if (!FoundStr.empty())
-        return FoundStr.c_str();
+    if (opts::cppMangleCache)
+        if ((FoundStr = pch.getCachedMangledName(CanonND)))
+        {
+            stats.cachedMangledNames++;
+            return FoundStr;
+        }
 
     auto& Context = calypso.getASTContext();
     auto MangleCtx = pch.MangleCtx;
@@ -513,8 +518,15 @@ const char *LangPlugin::mangle(Dsymbol *s)
         Str = II->getName();
     }
 
-    Str.str().swap(FoundStr);
-    return FoundStr.c_str();
+    auto Name = MangledDeclNamesAlloc.Allocate<char>(Str.size() + 1);
+    memcpy(Name, Str.data(), Str.size());
+    Name[Str.size()] = '\0';
+
+    FoundStr = Name;
+    stats.mangledNames++;
+    if (opts::cppMangleCache)
+        pch.addMangledName(CanonND, Name);
+    return FoundStr;
 }
 
 void LangPlugin::mangleAnonymousAggregate(OutBuffer *buf, ::AggregateDeclaration* ad)
@@ -571,6 +583,42 @@ void InstantiationChecker::FunctionDefinitionInstantiated(const clang::FunctionD
     }
 }
 
+// WORKAROUND for https://llvm.org/bugs/show_bug.cgi?id=24420
+// « RecordDecl::LoadFieldsFromExternalStorage() expels existing decls from the DeclContext linked list »
+// Sema just appended an implicit member to a record whose lexical decls may still be in the PCH, so splice
+// them in now, before anything gets to call field_begin() and replace the decl chain with the serialized fields.
+void InstantiationChecker::AddedCXXImplicitMember(const clang::CXXRecordDecl *RD, const clang::Decl *D)
+{
+    if (RD->hasExternalLexicalStorage())
+        RD->decls_begin();
+}
+
+/***********************/
+
+// ASTWriter of a chained PCH layer. It's part of the AST consumer before the base PCH gets loaded, so that it gets
+// registered as the deserialization listener of the ASTReader like with -include-pch, and learns the IDs of the
+// types and decls of the base layers instead of writing them again into the new layer.
+class ChainedPCHWriter : public clang::ASTConsumer
+{
+public:
+    std::shared_ptr<clang::PCHBuffer> Buffer = std::make_shared<clang::PCHBuffer>();
+    llvm::BitstreamWriter Stream;
+    clang::ASTWriter Writer;
+
+    ChainedPCHWriter()
+        : Stream(Buffer->Data),
+          Writer(Stream, llvm::ArrayRef<llvm::IntrusiveRefCntPtr<clang::ModuleFileExtension>>()) {}
+
+    clang::ASTMutationListener *GetASTMutationListener() override { return &Writer; }
+    clang::ASTDeserializationListener *GetASTDeserializationListener() override { return &Writer; }
+
+    void write(clang::Sema &S, const std::string &OutputFile, llvm::StringRef isysroot)
+    {
+        Writer.WriteAST(S, OutputFile, nullptr, isysroot, /*hasErrors=*/ false);
+        Buffer->IsComplete = true;
+    }
+};
+
 /***********************/
 
 DiagMuter::DiagMuter()
@@ -587,6 +635,96 @@ DiagMuter::~DiagMuter()
 
 #define MAX_FILENAME_SIZE 4096
 
+static const char *layerSeparator = "--"; // separates the headers of each chained PCH layer in the header list
+static const char *headerAliasesSuffix = ".aliases"; // header names dropped by PCH::pruneIncludedHeaders(), next to the header list
+
+static std::string hashToString(llvm::MD5 &Hash)
+{
+    llvm::MD5::MD5Result Result;
+    Hash.final(Result);
+
+    llvm::SmallString<32> Str;
+    llvm::MD5::stringifyResult(Result, Str);
+    return Str.str().substr(0, 16);
+}
+
+// Cache files may be shared by concurrent compilations, so they're written into a temporary file first
+// and then renamed, which atomically replaces the old version for the readers
+static void writeCacheFile(llvm::StringRef path, llvm::function_ref<void(llvm::raw_ostream&)> write)
+{
+    int FD;
+    llvm::SmallString<128> tmpPath;
+    if (llvm::sys::fs::createUniqueFile(path + "-%%%%%%%%.tmp", FD, tmpPath))
+    {
+        ::error(Loc(), "Temporary file for cache file %s couldn't be created", path.str().c_str());
+        fatal();
+    }
+
+    {
+        llvm::raw_fd_ostream OS(FD, /*shouldClose=*/ true);
+        write(OS);
+    }
+
+    if (llvm::sys::fs::rename(tmpPath, path))
+    {
+        llvm::sys::fs::remove(tmpPath);
+        ::error(Loc(), "Cache file %s couldn't be replaced", path.str().c_str());
+        fatal();
+    }
+}
+
+// Records appended to a cache file by concurrent compilations are prefixed by their length, so that the ones torn by
+// a compilation which died in the middle of writing get rejected.
+static void writeCacheRecord(llvm::raw_ostream &OS, llvm::StringRef record)
+{
+    OS << record.size() << " " << record << "\n";
+}
+
+static void forEachCacheRecord(llvm::StringRef contents, llvm::function_ref<void(llvm::StringRef)> fn)
+{
+    llvm::SmallVector<llvm::StringRef, 256> Lines;
+    contents.split(Lines, '\n', -1, false);
+
+    for (auto Line: Lines)
+    {
+        llvm::StringRef Len, Record;
+        std::tie(Len, Record) = Line.split(' ');
+
+        size_t len;
+        if (Len.getAsInteger(10, len) || len != Record.size())
+            continue;
+        fn(Record);
+    }
+}
+
+// Appends the records with a single write while holding the lock of the file, so that the records of concurrent
+// compilations never interleave. Not being able to write is not an error, the records will be computed again.
+static void appendCacheRecords(llvm::StringRef path, llvm::StringRef records)
+{
+    if (records.empty())
+        return;
+
+    llvm::LockFileManager Locker(path);
+    switch (Locker.getState())
+    {
+        case llvm::LockFileManager::LFS_Owned:
+            break;
+        case llvm::LockFileManager::LFS_Shared:
+            if (Locker.waitForUnlock() != llvm::LockFileManager::Res_Timeout)
+                return appendCacheRecords(path, records);
+            return;
+        case llvm::LockFileManager::LFS_Error:
+            return;
+    }
+
+    int FD;
+    if (llvm::sys::fs::openFileForWrite(path, FD, llvm::sys::fs::F_Append))
+        return;
+
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/ true, /*unbuffered=*/ true);
+    OS << records;
+}
+
 void PCH::init()
 {
     clang::IntrusiveRefCntPtr<clang::DiagnosticOptions> DiagOpts(new clang::DiagnosticOptions);
@@ -596,6 +734,24 @@ void PCH::init()
     Diags = new clang::DiagnosticsEngine(DiagID,
                                          &*DiagOpts, DiagClient);
 
+    // Every combination of -cpp-args, -cpp-modules, target and Clang version gets its own cache directory
+    // so that switching between configurations doesn't invalidate the cached PCH each time
+    llvm::MD5 ConfigHash;
+    for (auto& cppArg: opts::cppArgs)
+    {
+        ConfigHash.update(cppArg);
+        ConfigHash.update(llvm::ArrayRef<uint8_t>((const uint8_t *) "\0", 1));
+    }
+    ConfigHash.update(global.params.targetTriple.str());
+    if (opts::cppModules)
+        ConfigHash.update("-cpp-modules");
+    ConfigHash.update(clang::getClangFullRepositoryVersion());
+
+    llvm::SmallString<128> cacheDir(opts::cppCacheDir);
+    llvm::sys::path::append(cacheDir, llvm::Twine(calypso.cachePrefix) + "-" + hashToString(ConfigHash));
+    calypso.cacheDir = cacheDir.str().str();
+    llvm::sys::fs::create_directories(calypso.cacheDir);
+
     auto headerList = calypso.getCacheFilename();
 
     auto fheaderList = fopen(headerList.c_str(), "r"); // ordered list of headers
@@ -611,10 +767,41 @@ void PCH::init()
         if (linebuf[0] == '\0')
             continue;
 
+        if (strcmp(linebuf, layerSeparator) == 0)
+        {
+            headerLayers.push_back(headers.dim); // the following headers are in a chained PCH
+            continue;
+        }
+
+        if (headerLayers.empty())
+            headerLayers.push_back(0);
         headers.push(strdup(linebuf));
+        headerSet.insert(linebuf);
     }
 
     fclose(fheaderList);
+    numCachedHeaders = headers.dim;
+
+    // Header names known to be other names of headers included by the cached PCH, so that they get ignored by add()
+    // without having to go through the SLoc entries of the PCH again
+    if (auto Buf = llvm::MemoryBuffer::getFile(calypso.getCacheFilename(headerAliasesSuffix)))
+        forEachCacheRecord((*Buf)->getBuffer(), [&] (llvm::StringRef Alias) {
+            headerSet.insert(Alias);
+        });
+
+    // Module map files found by the previous compilations, needed by -cpp-modules before the headers get parsed
+    auto fmoduleMapList = fopen(calypso.getCacheFilename(".modulemaps").c_str(), "r");
+    if (!fmoduleMapList)
+        return;
+
+    while (fgets(linebuf, MAX_FILENAME_SIZE, fmoduleMapList) != NULL)
+    {
+        linebuf[strcspn(linebuf, "\n")] = '\0';
+        if (linebuf[0] != '\0')
+            moduleMapFiles.push_back(linebuf);
+    }
+
+    fclose(fmoduleMapList);
 }
 
 void PCH::add(const char* header, ::Module *from)
@@ -639,15 +826,358 @@ void PCH::add(const char* header, ::Module *from)
         }
     }
 
-    for (unsigned i = 0; i < headers.dim; i++)
-        if (strcmp(header, headers[i]) == 0)
+    if (!headerSet.insert(header).second)
+        return;
+
+    // Modmaps may still be added once the AST is loaded, but there's no need to reload it if the header is already part of it
+    if (AST)
+    {
+        auto File = lookupHeader(header);
+        if (File && isIncluded(File))
+        {
+            saveHeaderAliases({ header });
             return;
+        }
+    }
 
     headers.push(header);
     needHeadersReload = true;
 }
 
-void PCH::loadFromHeaders(clang::driver::Compilation* C)
+// Resolve a header name to its FileEntry the way the #include of the PCH header does, i.e quoted names relative to the
+// directory of the PCH header first, then through the header search paths of the AST
+// FileEntries are unique per file, so differently named headers pointing to the same file get the same one
+const clang::FileEntry *PCH::lookupHeader(const char *header)
+{
+    auto& HS = AST->getPreprocessor().getHeaderSearchInfo();
+    auto& FileMgr = AST->getFileManager();
+
+    llvm::StringRef Filename(header);
+    bool isAngled = Filename.startswith("<");
+    if (isAngled || Filename.startswith("\""))
+        Filename = Filename.substr(1, Filename.size() - 2);
+
+    if (llvm::sys::path::is_absolute(Filename))
+        return FileMgr.getFile(Filename);
+
+    if (!isAngled)
+    {
+        llvm::SmallString<128> Path(llvm::sys::path::parent_path(pchHeader));
+        llvm::sys::path::append(Path, Filename);
+        if (auto File = FileMgr.getFile(Path))
+            return File;
+    }
+
+    for (auto DL = isAngled ? HS.angled_dir_begin() : HS.search_dir_begin(),
+            DLEnd = HS.search_dir_end(); DL != DLEnd; ++DL)
+    {
+        if (!DL->isNormalDir())
+            continue;
+
+        llvm::SmallString<128> Path(DL->getDir()->getName());
+        llvm::sys::path::append(Path, Filename);
+        if (auto File = FileMgr.getFile(Path))
+            return File;
+    }
+
+    return nullptr;
+}
+
+bool PCH::isIncluded(const clang::FileEntry *File)
+{
+    if (includedFilesAST != AST)
+    {
+        includedFiles.clear();
+        includedFilesAST = AST;
+
+        auto& SrcMgr = AST->getSourceManager();
+        auto addEntry = [&] (const clang::SrcMgr::SLocEntry& SLoc) {
+            if (SLoc.isFile())
+                if (auto OrigEntry = SLoc.getFile().getContentCache()->OrigEntry)
+                    includedFiles.insert(OrigEntry);
+        };
+
+        for (size_t i = 0; i < SrcMgr.local_sloc_entry_size(); i++)
+            addEntry(SrcMgr.getLocalSLocEntry(i));
+        for (size_t i = 0; i < SrcMgr.loaded_sloc_entry_size(); i++)
+            addEntry(SrcMgr.getLoadedSLocEntry(i));
+    }
+
+    return includedFiles.count(File);
+}
+
+// SourceManager::translateFile() only returns the first FileID of a FileEntry, but there's no other way to get all of them
+// than going through every SLoc entry, which is done once for all the Clang module imports
+const llvm::SmallVectorImpl<clang::FileID> &PCH::getFileIDs(const clang::FileEntry *File)
+{
+    if (!fileIDIndexBuilt)
+    {
+        fileIDIndexBuilt = true;
+
+        auto& SrcMgr = AST->getSourceManager();
+        auto addEntry = [&] (const clang::SrcMgr::SLocEntry& SLoc) {
+            if (!SLoc.isFile() || !SLoc.getFile().getContentCache())
+                return;
+
+            auto OrigEntry = SLoc.getFile().getContentCache()->OrigEntry;
+            if (!OrigEntry)
+                return;
+
+            auto Loc = clang::SourceLocation::getFromRawEncoding(SLoc.getOffset());
+            FileIDIndex[OrigEntry].push_back(SrcMgr.getFileID(Loc)); // NOTE: getting a FileID without a SourceLocation is impossible, it's locked tight
+        };
+
+        for (unsigned I = 0, N = SrcMgr.local_sloc_entry_size(); I != N; ++I)
+            addEntry(SrcMgr.getLocalSLocEntry(I));
+        for (unsigned I = 0, N = SrcMgr.loaded_sloc_entry_size(); I != N; ++I)
+            addEntry(SrcMgr.getLoadedSLocEntry(I));
+    }
+
+    return FileIDIndex[File];
+}
+
+// Load the cached PCH and drop the new headers that are already included by it or that are
+// another name for a preceding new header. If none is left the loaded AST is kept as is.
+void PCH::pruneIncludedHeaders()
+{
+    if (!loadFromPCH(nullptr))
+        return;
+
+    llvm::DenseSet<const clang::FileEntry*> newFiles;
+    std::vector<llvm::StringRef> aliases;
+
+    unsigned j = numCachedHeaders;
+    for (unsigned i = numCachedHeaders; i < headers.dim; i++)
+    {
+        auto File = lookupHeader(headers[i]);
+        if (File && isIncluded(File))
+        {
+            aliases.push_back(headers[i]);
+            continue;
+        }
+        if (File && !newFiles.insert(File).second)
+            continue;
+        headers[j++] = headers[i];
+    }
+    headers.setDim(j);
+
+    saveHeaderAliases(aliases);
+
+    if (headers.dim == numCachedHeaders)
+    {
+        needHeadersReload = false;
+        return;
+    }
+
+    delete AST;
+    AST = nullptr;
+    includedFilesAST = nullptr;
+}
+
+void PCH::saveHeaderAliases(llvm::ArrayRef<llvm::StringRef> aliases)
+{
+    std::string records;
+    llvm::raw_string_ostream OS(records);
+    for (auto& alias: aliases)
+        writeCacheRecord(OS, alias);
+
+    appendCacheRecords(calypso.getCacheFilename(headerAliasesSuffix), OS.str());
+}
+
+// Each set of headers gets its own cache entry, i.e a subdirectory of the configuration cache directory
+// named after the hash of the sorted header names, containing the PCH, the .gen list and the C++ module object files
+std::string PCH::entryDirFor(unsigned numHeaders)
+{
+    std::vector<llvm::StringRef> sortedHeaders;
+    for (unsigned i = 0; i < numHeaders; i++)
+        sortedHeaders.push_back(headers[i]);
+    std::sort(sortedHeaders.begin(), sortedHeaders.end());
+
+    llvm::MD5 Hash;
+    for (auto& header: sortedHeaders)
+    {
+        Hash.update(header);
+        Hash.update(llvm::ArrayRef<uint8_t>((const uint8_t *) "\0", 1));
+    }
+
+    llvm::SmallString<128> dir(calypso.cacheDir);
+    llvm::sys::path::append(dir, hashToString(Hash));
+    return dir.str().str();
+}
+
+// numHeaders is the number of headers of the whole chain, i.e where the top layer ends
+std::string PCH::layerFilename(unsigned layer, const char *suffix, unsigned numHeaders)
+{
+    auto layerEnd = (layer + 1 < headerLayers.size()) ? headerLayers[layer + 1] : numHeaders;
+
+    llvm::SmallString<128> fullpath(entryDirFor(layerEnd));
+    llvm::sys::path::append(fullpath, llvm::Twine(calypso.cachePrefix) + suffix);
+    return fullpath.str().str();
+}
+
+static const char *stampFilename = "calypso_cache.stamp"; // rewritten every time a cache entry gets used, its date is used by the eviction policy
+
+static void touchCacheEntry(llvm::StringRef dir)
+{
+    llvm::SmallString<128> stamp(dir);
+    llvm::sys::path::append(stamp, stampFilename);
+
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(stamp, EC, llvm::sys::fs::F_None);
+}
+
+static const char *modulesCacheSuffix = ".pcm"; // -cpp-modules PCMs, shared by the entries of a configuration
+
+static void removeDirectory(llvm::StringRef dir)
+{
+    using namespace llvm::sys;
+
+    std::error_code err;
+    for (fs::directory_iterator DirIt(dir, err), DirEnd; DirIt != DirEnd && !err; DirIt.increment(err))
+    {
+        if (fs::is_directory(DirIt->path()))
+            removeDirectory(DirIt->path());
+        else
+            fs::remove(DirIt->path());
+    }
+    fs::remove(dir);
+}
+
+// Takes the locks of every PCH in a cache entry, the same ones compilations building a PCH hold, and the in-use locks
+// of the compilations using the entry (see PCH::markEntriesInUse()), so that entries being built or used aren't
+// removed. The stale locks of compilations that died get taken over by LockFileManager.
+static bool lockCacheEntry(llvm::StringRef dir, std::vector<std::unique_ptr<llvm::LockFileManager>> &Locks)
+{
+    using namespace llvm::sys;
+
+    llvm::StringSet<> pchFiles;
+    std::vector<std::string> subdirs;
+
+    std::error_code err;
+    for (fs::directory_iterator DirIt(dir, err), DirEnd; DirIt != DirEnd && !err; DirIt.increment(err))
+    {
+        llvm::StringRef path(DirIt->path());
+        if (fs::is_directory(path))
+        {
+            if (!path::filename(path).endswith(modulesCacheSuffix))
+                subdirs.push_back(path);
+            continue;
+        }
+
+        if (path.endswith(".lock"))
+            pchFiles.insert(path.drop_back(5)); // a PCH being built
+        else if (path.endswith(".pch"))
+            pchFiles.insert(path);
+    }
+
+    for (auto& pchFile: pchFiles)
+    {
+        Locks.emplace_back(new llvm::LockFileManager(pchFile.getKey()));
+        if (Locks.back()->getState() != llvm::LockFileManager::LFS_Owned)
+            return false;
+    }
+
+    for (auto& subdir: subdirs)
+        if (!lockCacheEntry(subdir, Locks))
+            return false;
+
+    return true;
+}
+
+// Every compilation holds a lock of its own in each cache entry it uses until it exits, so that the objects, .gen list,
+// module declarations and mangled names it keeps writing there don't get evicted by other compilations underneath it
+void PCH::markEntriesInUse()
+{
+    auto markInUse = [&] (llvm::StringRef dir) {
+        if (inUseLocks.count(dir))
+            return;
+
+        llvm::sys::fs::create_directories(dir);
+
+        // Only the lock file matters, the unique name just keeps the locks of concurrent compilations apart
+        llvm::SmallString<128> model(dir), marker;
+        llvm::sys::path::append(model, llvm::Twine(calypso.cachePrefix) + ".inuse-%%%%%%%%");
+        if (llvm::sys::fs::createUniqueFile(model, marker))
+            return;
+        llvm::sys::fs::remove(marker);
+
+        inUseLocks[dir] = std::make_shared<llvm::LockFileManager>(marker);
+    };
+
+    for (unsigned layer = 0; layer < headerLayers.size(); layer++)
+        markInUse(llvm::sys::path::parent_path(layerFilename(layer, ".h.pch", headers.dim)));
+    markInUse(entryDir);
+}
+
+// Only keep the most recently used -cpp-cachekeep subdirectories of dir whose name starts with prefix
+static void evictCacheEntries(llvm::StringRef dir, llvm::StringRef prefix = llvm::StringRef())
+{
+    using namespace llvm::sys;
+
+    std::vector<std::pair<llvm::sys::TimeValue, std::string>> entries;
+
+    std::error_code err;
+    for (fs::directory_iterator DirIt(dir, err), DirEnd; DirIt != DirEnd && !err; DirIt.increment(err))
+    {
+        auto& path = DirIt->path();
+        if (!fs::is_directory(path) || !path::filename(path).startswith(prefix) ||
+                path::filename(path).endswith(modulesCacheSuffix)) // Clang prunes the modules cache itself
+            continue;
+
+        llvm::SmallString<128> stamp(path);
+        path::append(stamp, stampFilename);
+
+        fs::file_status result;
+        if (fs::status(stamp, result) && fs::status(path, result))
+            continue;
+        entries.emplace_back(result.getLastModificationTime(), path);
+    }
+
+    if (entries.size() <= opts::cppCacheKeep)
+        return;
+
+    std::sort(entries.begin(), entries.end(),
+              [] (const std::pair<llvm::sys::TimeValue, std::string>& a, const std::pair<llvm::sys::TimeValue, std::string>& b)
+                    { return a.first > b.first; });
+
+    for (size_t i = opts::cppCacheKeep; i < entries.size(); i++)
+    {
+        std::vector<std::unique_ptr<llvm::LockFileManager>> Locks;
+        if (!lockCacheEntry(entries[i].second, Locks))
+            continue; // in use by another compilation
+
+        removeDirectory(entries[i].second); // configuration directories hold the entries and the nested PCM directories
+    }
+}
+
+void PCH::writeHeaderList()
+{
+    writeCacheFile(calypso.getCacheFilename(), [&] (llvm::raw_ostream& OS) {
+        unsigned layer = 1;
+        for (unsigned i = 0; i < headers.dim; ++i)
+        {
+            if (layer < headerLayers.size() && headerLayers[layer] == i)
+            {
+                OS << layerSeparator << "\n";
+                layer++;
+            }
+            OS << headers[i] << "\n";
+        }
+    });
+}
+
+// The module map files of a cache entry are indexed along with the modification times of the directories they were
+// looked for in, i.e every directory containing a header. When none of these directories changed, no directory needs
+// to be listed and the module maps are parsed straight away.
+// Index lines are either "d <stamp> <directory>" or "m <stamp> <module map file>", see getFileStamp().
+static const char *moduleMapIndexSuffix = ".mmapindex";
+
+static const char *moduleDeclsSuffix = ".moddecls";
+static const char *mangledNamesSuffix = ".mangles";
+
+// If basePCH is set, only the headers of the top layer get parsed, on top of the already cached PCH
+// Returns false if parsing the chained layer failed
+bool PCH::loadFromHeaders(clang::driver::Compilation* C, const char *basePCH)
 {
     // We use a trick from clang-interpreter to extract -cc1 flags from "puny human" flags
     // We expect to get back exactly one command job, if we didn't something
@@ -662,6 +1192,15 @@ void PCH::loadFromHeaders(clang::driver::Compilation* C)
     clang::CompilerInvocation CI;
     clang::CompilerInvocation::CreateFromArgs(CI, CCArgs.begin(), CCArgs.end(), *Diags);
 
+    chainedLayer = basePCH != nullptr;
+    if (chainedLayer)
+        CI.getPreprocessorOpts().ImplicitPCHInclude = basePCH; // same as -include-pch
+
+    PCHContainerOps.reset(new clang::PCHContainerOperations);
+
+    if (CI.getLangOpts()->Modules)
+        prebuildModules(CI);
+
     // Parse the headers
     DiagClient->muted = false;
 
@@ -669,11 +1208,21 @@ void PCH::loadFromHeaders(clang::driver::Compilation* C)
         new clang::vfs::OverlayFileSystem(clang::vfs::getRealFileSystem()));
     auto Files = new clang::FileManager(clang::FileSystemOptions(), OverlayFileSystem);
 
-    PCHContainerOps.reset(new clang::PCHContainerOperations);
+    clang::ASTConsumer *Consumer = new InstantiationChecker;
+    chainWriter = nullptr;
+    if (chainedLayer)
+    {
+        chainWriter = new ChainedPCHWriter;
+
+        std::vector<std::unique_ptr<clang::ASTConsumer>> Consumers;
+        Consumers.emplace_back(Consumer);
+        Consumers.emplace_back(chainWriter);
+        Consumer = new clang::MultiplexConsumer(std::move(Consumers));
+    }
 
     AST = ASTUnit::LoadFromCompilerInvocation(&CI, PCHContainerOps, Diags, Files, false, false, false,
                                               clang::TU_Complete, false, false, false,
-                                              new InstantiationChecker).release();
+                                              Consumer).release();
     AST->getSema();
     Diags->getClient()->BeginSourceFile(AST->getLangOpts(), &AST->getPreprocessor());
 
@@ -682,39 +1231,155 @@ void PCH::loadFromHeaders(clang::driver::Compilation* C)
 
     if (Diags->hasErrorOccurred())
     {
+        if (chainedLayer)
+            return false;
+
         ::error(Loc(), "Invalid C/C++ header(s)");
         fatal();
     }
 
     /* Update the list of headers */
+    writeHeaderList();
+    if (!basePCH)
+        llvm::sys::fs::remove(calypso.getCacheFilename(headerAliasesSuffix), true); // the headers may include other files
 
-    auto headerList = calypso.getCacheFilename();
-    auto fheaderlist = fopen(headerList.c_str(), "w");
-    if (fheaderlist == NULL)
+    /* Mark every C++ module object file dirty */
+
+    auto genListFilename = calypso.getCacheEntryFilename(".gen");
+    llvm::sys::fs::remove(genListFilename, true);
+    llvm::sys::fs::remove(calypso.getCacheEntryFilename(moduleMapIndexSuffix), true); // the headers may be in new directories
+    llvm::sys::fs::remove(calypso.getCacheEntryFilename(moduleDeclsSuffix), true);
+    llvm::sys::fs::remove(calypso.getCacheEntryFilename(mangledNamesSuffix), true);
+
+    return true;
+}
+
+// Size and full resolution modification time, so that edits made within the second the index was written are noticed
+static bool getFileStamp(llvm::StringRef path, std::string &stamp)
+{
+    llvm::sys::fs::file_status result;
+    if (llvm::sys::fs::status(path, result))
+        return false;
+
+    auto mtime = result.getLastModificationTime();
+    stamp = std::to_string(result.getSize()) + "-" + std::to_string(mtime.toPosixTime()) + "." +
+                std::to_string(mtime.nanoseconds());
+    return true;
+}
+
+bool PCH::loadModuleMapIndex(llvm::function_ref<void(llvm::StringRef, const clang::DirectoryEntry*)> parseModuleMap)
+{
+    auto indexFilename = calypso.getCacheEntryFilename(moduleMapIndexSuffix);
+    auto findex = fopen(indexFilename.c_str(), "r");
+    if (!findex)
+        return false;
+
+    std::vector<std::string> indexedModuleMapFiles;
+    bool upToDate = true;
+
+    char linebuf[MAX_FILENAME_SIZE];
+    while (upToDate && fgets(linebuf, sizeof(linebuf), findex) != NULL)
     {
-        ::error(Loc(), "C/C++ header list cache file couldn't be opened/created");
-        fatal();
+        linebuf[strcspn(linebuf, "\n")] = '\0';
+
+        char kind;
+        char indexedStamp[64];
+        int pathStart;
+        std::string stamp;
+
+        if (sscanf(linebuf, "%c %63s %n", &kind, indexedStamp, &pathStart) != 2 || (kind != 'd' && kind != 'm'))
+        {
+            upToDate = false;
+            break;
+        }
+
+        upToDate = getFileStamp(linebuf + pathStart, stamp) && stamp == indexedStamp;
+        if (kind == 'm')
+            indexedModuleMapFiles.push_back(linebuf + pathStart);
     }
 
-    for (unsigned i = 0; i < headers.dim; ++i)
-        fprintf(fheaderlist, "%s\n", headers[i]);
+    fclose(findex);
 
-    fclose(fheaderlist);
+    if (!upToDate)
+        return false;
 
-    /* Mark every C++ module object file dirty */
+    for (auto& path: indexedModuleMapFiles)
+    {
+        auto Dir = AST->getFileManager().getDirectory(llvm::sys::path::parent_path(path));
+        if (!Dir)
+            return false;
+        parseModuleMap(path, Dir);
+    }
 
-    auto genListFilename = calypso.getCacheFilename(".gen");
-    llvm::sys::fs::remove(genListFilename, true);
+    // Without the walk through every SLoc entry, the headers of a loaded PCH still need to be checked for changes
+    if (auto Reader = AST->getASTReader())
+        for (auto MF: Reader->getModuleManager())
+            Reader->visitInputFiles(*MF, /*IncludeSystem=*/ true, /*Complain=*/ true,
+                                    [] (const clang::serialization::InputFile &, bool) {});
+
+    return true;
 }
 
-// WORKAROUND Temporary visitor to deserialize the entire ASTContext
-class ASTDummyVisitor : public clang::RecursiveASTVisitor<ASTDummyVisitor>
+void PCH::writeModuleMapIndex(const llvm::DenseSet<const clang::DirectoryEntry*> &Dirs,
+                              const std::vector<std::string> &entryModuleMapFiles)
 {
-public:
-    bool shouldVisitTemplateInstantiations() const { return true; }
-};
+    writeCacheFile(calypso.getCacheEntryFilename(moduleMapIndexSuffix), [&] (llvm::raw_ostream& OS) {
+        std::string stamp;
+        for (auto Dir: Dirs)
+            if (getFileStamp(Dir->getName(), stamp))
+                OS << "d " << stamp << " " << Dir->getName() << "\n";
+
+        // The module maps themselves may be edited without their directory changing
+        for (auto& path: entryModuleMapFiles)
+            if (getFileStamp(path, stamp))
+                OS << "m " << stamp << " " << path << "\n";
+    });
+}
+
+// -cpp-modules: each new header gets included by its own worker thread, so that the PCMs of the Clang modules
+// they belong to are built in parallel. Threads (or other compilations) needing a PCM that's being built wait
+// for Clang's lock on it, and the parse of the headers that follows only has to load the PCMs.
+void PCH::prebuildModules(const clang::CompilerInvocation &CI)
+{
+    llvm::ThreadPool Pool;
+
+    for (unsigned i = headerLayers.back(); i < headers.dim; i++)
+    {
+        std::string header(headers[i]);
+
+        Pool.async([this, &CI, header, i] {
+            llvm::SmallString<128> importFilename(entryDir);
+            llvm::sys::path::append(importFilename, "calypso_import_" + llvm::utostr(i) + ".h");
+
+            std::string importContents("#include ");
+            if (header[0] == '<')
+                importContents += header;
+            else
+                importContents += "\"" + header + "\"";
+
+            clang::CompilerInstance Clang(PCHContainerOps);
+            Clang.setInvocation(new clang::CompilerInvocation(CI));
+
+            auto& FrontendOpts = Clang.getFrontendOpts();
+            FrontendOpts.Inputs.clear();
+            FrontendOpts.Inputs.emplace_back(importFilename.str(), clang::IK_CXX);
+            Clang.getPreprocessorOpts().ImplicitPCHInclude.clear();
+            Clang.getPreprocessorOpts().addRemappedFile(importFilename,
+                        llvm::MemoryBuffer::getMemBufferCopy(importContents).release());
 
-void PCH::loadFromPCH(clang::driver::Compilation* C)
+            // Errors will be reported by the main parse
+            Clang.createDiagnostics(new clang::IgnoringDiagConsumer);
+
+            clang::PreprocessOnlyAction Act;
+            Clang.ExecuteAction(Act);
+        });
+    }
+
+    Pool.wait();
+}
+
+// If C is null, returns false instead of falling back to the headers when the PCH can't be used
+bool PCH::loadFromPCH(clang::driver::Compilation* C)
 {
     clang::FileSystemOptions FileSystemOpts;
     clang::ASTReader::ASTReadResult ReadResult;
@@ -724,9 +1389,20 @@ void PCH::loadFromPCH(clang::driver::Compilation* C)
     PCHContainerOps.reset(new clang::PCHContainerOperations);
     auto *Reader = PCHContainerOps->getReaderOrNull("raw");
 
+    auto getStamp = [&] () -> std::string {
+        llvm::sys::fs::file_status result;
+        if (llvm::sys::fs::status(pchFilename, result))
+            return std::string();
+        return std::to_string(result.getSize()) + "-" +
+                std::to_string(result.getLastModificationTime().toPosixTime());
+    };
+    auto stampBefore = getStamp();
+
+    // The PCH file gets memory-mapped read-only by the ASTReader, so its pages are shared through the page cache
+    // by every compilation loading it (unless the files are flagged volatile, in which case they're read into private memory)
     AST = ASTUnit::LoadFromASTFile(pchFilename, *Reader,
                             Diags, FileSystemOpts, false, false, llvm::None, false,
-                            /* AllowPCHWithCompilerErrors = */ true, false,
+                            /* AllowPCHWithCompilerErrors = */ true, /* UserFilesAreVolatile = */ false,
                             new InstantiationChecker, &ReadResult).release();
 
     DiagClient->muted = !opts::cppVerboseDiags;
@@ -741,24 +1417,200 @@ void PCH::loadFromPCH(clang::driver::Compilation* C)
         case clang::ASTReader::VersionMismatch:
         case clang::ASTReader::ConfigurationMismatch:
             delete AST;
+            AST = nullptr;
             Diags->Reset();
 
+            if (!C)
+                return false;
+
             // Headers or flags may have changed since the PCH was generated, fall back to headers.
             loadFromHeaders(C);
-            return;
+            return true;
 
         default:
             fatal();
-            return;
+            return false;
     }
 
     if (!AST)
         fatal();
 
-    // WORKAROUND for https://llvm.org/bugs/show_bug.cgi?id=24420
-    // « RecordDecl::LoadFieldsFromExternalStorage() expels existing decls from the DeclContext linked list »
-    // This only concerns serialized declarations, new records aren't affected by this issue
-    ASTDummyVisitor().TraverseDecl(AST->getASTContext().getTranslationUnitDecl());
+    // Another compilation may have replaced the file in the meantime
+    auto stampAfter = getStamp();
+    if (stampBefore == stampAfter)
+        pchStamp = stampAfter;
+
+    return true;
+}
+
+// Lines are "<PCH size>-<PCH mtime> <lookup time> <module name> <DeclID>:<flags>...", only the ones matching the PCH file
+// the AST was loaded from are valid since DeclIDs change whenever the PCH gets written again.
+bool PCH::loadModuleDecls(llvm::StringRef moduleName, ModuleDeclsTy &Decls, double &lookupTime)
+{
+    if (pchStamp.empty())
+        return false;
+
+    if (!moduleDeclsParsed)
+    {
+        moduleDeclsParsed = true;
+
+        auto Buf = llvm::MemoryBuffer::getFile(calypso.getCacheEntryFilename(moduleDeclsSuffix));
+        if (!Buf)
+            return false;
+
+        forEachCacheRecord((*Buf)->getBuffer(), [&] (llvm::StringRef Line) {
+            llvm::StringRef Stamp, Time, Name;
+            std::tie(Stamp, Line) = Line.split(' ');
+            if (Stamp != pchStamp)
+                return;
+            std::tie(Time, Line) = Line.split(' ');
+            std::tie(Name, Line) = Line.split(' ');
+
+            auto& Entry = moduleDeclIDs[Name];
+            if (!Entry.second.empty())
+                return; // concurrent compilations may have appended the same module
+
+            Entry.first = strtod(Time.str().c_str(), nullptr);
+            while (!Line.empty())
+            {
+                llvm::StringRef Item, ID, Flags;
+                std::tie(Item, Line) = Line.split(' ');
+                std::tie(ID, Flags) = Item.split(':');
+
+                unsigned id, flags;
+                if (ID.getAsInteger(10, id) || Flags.getAsInteger(10, flags))
+                {
+                    Entry.second.clear();
+                    break;
+                }
+                Entry.second.emplace_back(id, flags);
+            }
+        });
+    }
+
+    auto Found = moduleDeclIDs.find(moduleName);
+    if (Found == moduleDeclIDs.end() || Found->second.second.empty())
+        return false;
+
+    auto Reader = AST->getASTReader();
+    for (auto& P: Found->second.second)
+        Decls.emplace_back(Reader->GetDecl(P.first), P.second);
+
+    lookupTime = Found->second.first;
+    return true;
+}
+
+void PCH::saveModuleDecls(llvm::StringRef moduleName, const ModuleDeclsTy &Decls, double lookupTime)
+{
+    if (pchStamp.empty() || Decls.empty())
+        return;
+
+    std::string record;
+    llvm::raw_string_ostream OS(record);
+    OS << pchStamp << " " << llvm::format("%.6f", lookupTime) << " " << moduleName;
+
+    for (auto& P: Decls)
+    {
+        auto ID = P.first->getGlobalID();
+        if (!ID)
+            return; // declared after the PCH was loaded, e.g implicit members
+        OS << " " << ID << ":" << P.second;
+    }
+    OS.flush();
+
+    std::string line;
+    llvm::raw_string_ostream LineOS(line);
+    writeCacheRecord(LineOS, record);
+    LineOS.flush();
+
+    appendCacheRecords(calypso.getCacheEntryFilename(moduleDeclsSuffix), line);
+}
+
+// Same validity rules as .moddecls, lines are "<PCH size>-<PCH mtime> <DeclID> <mangled name>"
+const char *PCH::getCachedMangledName(const clang::Decl *D)
+{
+    if (pchStamp.empty())
+        return nullptr;
+
+    if (!mangledNamesParsed)
+    {
+        mangledNamesParsed = true;
+
+        auto Buf = llvm::MemoryBuffer::getFile(calypso.getCacheEntryFilename(mangledNamesSuffix));
+        if (Buf)
+        {
+            forEachCacheRecord((*Buf)->getBuffer(), [&] (llvm::StringRef Line) {
+                llvm::StringRef Stamp, ID, Name;
+                std::tie(Stamp, Line) = Line.split(' ');
+                if (Stamp != pchStamp)
+                    return;
+                std::tie(ID, Name) = Line.split(' ');
+
+                unsigned id;
+                if (ID.getAsInteger(10, id) || Name.empty())
+                    return;
+
+                auto& Entry = cachedMangledNames[id];
+                if (Entry)
+                    return;
+
+                auto Str = MangledNamesAlloc.Allocate<char>(Name.size() + 1);
+                memcpy(Str, Name.data(), Name.size());
+                Str[Name.size()] = '\0';
+                Entry = Str;
+            });
+        }
+    }
+
+    auto ID = D->getGlobalID();
+    if (!ID)
+        return nullptr;
+
+    auto Found = cachedMangledNames.find(ID);
+    return Found != cachedMangledNames.end() ? Found->second : nullptr;
+}
+
+// Anonymous records and local declarations get numbered by the MangleContext in the order they're mangled,
+// their names may differ from one compilation to the other
+static bool hasStableMangling(const clang::Decl *D)
+{
+    while (true)
+    {
+        if (auto Tag = dyn_cast<clang::TagDecl>(D))
+            if (!Tag->getIdentifier() && !Tag->getTypedefNameForAnonDecl())
+                return false;
+
+        auto DC = D->getDeclContext();
+        if (DC->isFunctionOrMethod())
+            return false;
+        if (isa<clang::TranslationUnitDecl>(DC))
+            return true;
+
+        D = cast<clang::Decl>(DC);
+    }
+}
+
+void PCH::addMangledName(const clang::Decl *D, const char *Name)
+{
+    if (pchStamp.empty() || !D->getGlobalID() || !hasStableMangling(D))
+        return;
+
+    newMangledNames.emplace_back(D->getGlobalID(), Name);
+}
+
+void PCH::saveMangledNames()
+{
+    if (newMangledNames.empty())
+        return;
+
+    std::string lines;
+    llvm::raw_string_ostream OS(lines);
+    for (auto& P: newMangledNames)
+        writeCacheRecord(OS, (llvm::Twine(pchStamp) + " " + llvm::Twine(P.first) + " " + P.second).str());
+    OS.flush();
+    newMangledNames.clear();
+
+    appendCacheRecords(calypso.getCacheEntryFilename(mangledNamesSuffix), lines);
 }
 
 void PCH::update()
@@ -772,10 +1624,9 @@ void PCH::update()
     // FIXME
     assert(!(needHeadersReload && AST) && "Need AST merging FIXME");
 
-    auto AddSuffixThenCheck = [&] (const char *suffix, bool dirtyPCH = true) {
+    auto CheckFilename = [&] (std::string fn_var, bool dirtyPCH = true) {
         using namespace llvm::sys::fs;
 
-        auto fn_var = calypso.getCacheFilename(suffix);
         file_status result;
         status(fn_var, result);
         if (is_directory(result)) {
@@ -789,31 +1640,88 @@ void PCH::update()
         return fn_var;
     };
 
-    pchHeader = AddSuffixThenCheck(".h");
-    pchFilename = AddSuffixThenCheck(".h.pch");
-//     pchFilenameNew = AddSuffixThenCheck(".new.pch", false);
+    if (headerLayers.empty())
+        headerLayers.push_back(0);
+
+    for (unsigned layer = 0; layer < headerLayers.size(); layer++)
+    {
+        pchHeader = CheckFilename(layerFilename(layer, ".h", numCachedHeaders));
+        pchFilename = CheckFilename(layerFilename(layer, ".h.pch", numCachedHeaders)); // the top layer is the one loaded, which loads the layers below
+    }
+//     pchFilenameNew = CheckFilename(calypso.getCacheFilename(".new.pch"), false);
+
+    // The new headers may only be other names of headers already in the cached PCH
+    if (needHeadersReload && numCachedHeaders && numCachedHeaders < headers.dim &&
+            llvm::sys::fs::exists(pchFilename))
+        pruneIncludedHeaders();
+
+    // If only new headers were added, parse them into a chained PCH on top of the cached one
+    std::string basePCH;
+    if (needHeadersReload && opts::cppChainPCH && !chainingFailed &&
+            numCachedHeaders && numCachedHeaders < headers.dim &&
+            headerLayers.size() < maxLayers && llvm::sys::fs::exists(pchFilename))
+    {
+        basePCH = pchFilename;
+
+        headerLayers.push_back(numCachedHeaders);
+        pchHeader = layerFilename(headerLayers.size() - 1, ".h", headers.dim);
+        pchFilename = layerFilename(headerLayers.size() - 1, ".h.pch", headers.dim);
+    }
+    else if (needHeadersReload)
+    {
+        headerLayers.clear();
+        headerLayers.push_back(0);
+        pchHeader = layerFilename(0, ".h", headers.dim);
+        pchFilename = layerFilename(0, ".h.pch", headers.dim);
+    }
+
+    entryDir = llvm::sys::path::parent_path(pchFilename);
+    markEntriesInUse();
 
+    // Only one of the compilations sharing the cache builds the PCH of a given set of headers,
+    // the others wait for the lock to be released and then load the PCH it saved.
+    std::unique_ptr<llvm::LockFileManager> Locker;
     if (needHeadersReload)
     {
-        // Re-emit the source file with #include directives
-        auto fmono = fopen(pchHeader.c_str(), "w");
-        if (!fmono) {
-            ::error(Loc(), "C++ monolithic header couldn't be created");
-            fatal();
+        llvm::sys::fs::create_directories(entryDir);
+
+        Locker.reset(new llvm::LockFileManager(pchFilename));
+        switch (Locker->getState())
+        {
+            case llvm::LockFileManager::LFS_Owned:
+                break;
+            case llvm::LockFileManager::LFS_Shared:
+                Locker->waitForUnlock(); // if the owner died or timed out, the PCH will get built without lock
+                // fallthrough
+            case llvm::LockFileManager::LFS_Error:
+                Locker.reset();
+                break;
         }
 
-        for (unsigned i = 0; i < headers.dim; ++i) {
-            if (headers[i][0] == '<')
-                fprintf(fmono, "#include %s\n", headers[i]);
-            else
-                fprintf(fmono, "#include \"%s\"\n", headers[i]);
+        // Cache entries are keyed by their set of headers, so a PCH already present was built from the same headers
+        if (llvm::sys::fs::exists(pchFilename))
+        {
+            needHeadersReload = false;
+            numCachedHeaders = headers.dim;
+            writeHeaderList();
         }
-        fclose(fmono);
+    }
+
+    if (needHeadersReload || !llvm::sys::fs::exists(pchHeader))
+    {
+        // Re-emit the source file with #include directives
+        writeCacheFile(pchHeader, [&] (llvm::raw_ostream& OS) {
+            for (unsigned i = headerLayers.back(); i < headers.dim; ++i) {
+                if (headers[i][0] == '<')
+                    OS << "#include " << headers[i] << "\n";
+                else
+                    OS << "#include \"" << headers[i] << "\"\n";
+            }
+        });
     }
 
     // The driver doesn't do anything except computing the flags and informing us of the toolchain's C++ standard lib.
-    std::string TripleStr = llvm::sys::getProcessTriple();
-    llvm::Triple T(TripleStr);
+    auto& T = global.params.targetTriple;
 
     clang::IntrusiveRefCntPtr<clang::DiagnosticOptions> CC1DiagOpts(new clang::DiagnosticOptions);
     clang::IntrusiveRefCntPtr<clang::DiagnosticIDs> CC1DiagID(new clang::DiagnosticIDs);
@@ -828,6 +1736,19 @@ void PCH::update()
     Argv.push_back("clang");
     for (auto& cppArg: opts::cppArgs)
         Argv.push_back(cppArg.c_str());
+
+    // The PCMs are shared by every header set of the configuration
+    std::vector<std::string> moduleArgs;
+    if (opts::cppModules && !moduleMapFiles.empty())
+    {
+        moduleArgs.push_back("-fmodules");
+        moduleArgs.push_back("-fmodules-cache-path=" + calypso.getCacheFilename(modulesCacheSuffix));
+        for (auto& moduleMapFile: moduleMapFiles)
+            moduleArgs.push_back("-fmodule-map-file=" + moduleMapFile);
+    }
+    for (auto& moduleArg: moduleArgs)
+        Argv.push_back(moduleArg.c_str());
+
     Argv.push_back("-c");
     Argv.push_back("-x");
     Argv.push_back("c++-header");
@@ -842,15 +1763,34 @@ void PCH::update()
     if (needHeadersReload)
     {
         // The PCH either doesn't exist or is obsolete, reparse the header files
-        loadFromHeaders(C.get());
+        if (!loadFromHeaders(C.get(), basePCH.empty() ? nullptr : basePCH.c_str()))
+        {
+            // The cached PCH couldn't be used as base, start over and reparse everything
+            Diags->Reset();
+            delete AST;
+            AST = nullptr;
+            chainWriter = nullptr;
+            Locker.reset();
+
+            headerLayers.pop_back();
+            chainingFailed = true;
+            return update();
+        }
         needHeadersReload = false;
+        numCachedHeaders = headers.dim;
     }
-    else
+    else if (!AST)
     {
         // The PCH is up-to-date, use it
         loadFromPCH(C.get());
     }
 
+    if (Locker)
+    {
+        save(); // the compilations waiting for the lock expect to find the PCH
+        Locker.reset();
+    }
+
     /* Collect Clang module map files */
     auto& SrcMgr = AST->getSourceManager();
     auto& PP = AST->getPreprocessor();
@@ -858,48 +1798,69 @@ void PCH::update()
     MMap = new ModuleMap(AST->getSourceManager(), *Diags,
                             PP.getLangOpts(), &PP.getTargetInfo(), PP.getHeaderSearchInfo());
 
-    llvm::DenseSet<const clang::DirectoryEntry*> CheckedDirs;
-    auto lookForModuleMap = [&] (const clang::SrcMgr::SLocEntry& SLoc) {
-        if (SLoc.isExpansion())
-            return;
+    llvm::StringSet<> knownModuleMapFiles;
+    for (auto& moduleMapFile: moduleMapFiles)
+        knownModuleMapFiles.insert(moduleMapFile);
+    bool newModuleMapFiles = false;
 
-        auto OrigEntry = SLoc.getFile().getContentCache()->OrigEntry;
-        if (!OrigEntry)
-            return;
+    std::vector<std::string> entryModuleMapFiles;
+    auto parseModuleMap = [&] (llvm::StringRef path, const clang::DirectoryEntry *Dir) {
+        auto MMapFile = AST->getFileManager().getFile(path);
+        assert(MMapFile);
 
-        auto Dir = OrigEntry->getDir();
+        if (MMap->parseModuleMapFile(MMapFile, false, Dir))
+        {
+            ::error(Loc(), "Clang module map '%s/%s' file parsing failed",
+                            MMapFile->getDir(), MMapFile->getName());
+            fatal();
+        }
 
-        if (CheckedDirs.count(Dir))
-            return;
-        CheckedDirs.insert(Dir);
+        entryModuleMapFiles.push_back(path);
+        if (knownModuleMapFiles.insert(path).second)
+        {
+            moduleMapFiles.push_back(path);
+            newModuleMapFiles = true;
+        }
+    };
 
-        std::error_code err;
-        llvm::sys::fs::directory_iterator DirIt(llvm::Twine(Dir->getName()), err), DirEnd;
+    if (!loadModuleMapIndex(parseModuleMap))
+    {
+        llvm::DenseSet<const clang::DirectoryEntry*> CheckedDirs;
+        auto lookForModuleMap = [&] (const clang::SrcMgr::SLocEntry& SLoc) {
+            if (SLoc.isExpansion())
+                return;
 
-        for (; DirIt != DirEnd && !err; DirIt.increment(err))
-        {
-            auto path = DirIt->path();
-            auto extension = llvm::sys::path::extension(path);
+            auto OrigEntry = SLoc.getFile().getContentCache()->OrigEntry;
+            if (!OrigEntry)
+                return;
 
-            if (extension.equals(".modulemap_d"))
+            auto Dir = OrigEntry->getDir();
+
+            if (CheckedDirs.count(Dir))
+                return;
+            CheckedDirs.insert(Dir);
+
+            std::error_code err;
+            llvm::sys::fs::directory_iterator DirIt(llvm::Twine(Dir->getName()), err), DirEnd;
+
+            for (; DirIt != DirEnd && !err; DirIt.increment(err))
             {
-                auto MMapFile = AST->getFileManager().getFile(path);
-                assert(MMapFile);
+                auto path = DirIt->path();
+                auto extension = llvm::sys::path::extension(path);
 
-                if (MMap->parseModuleMapFile(MMapFile, false, Dir))
-                {
-                    ::error(Loc(), "Clang module map '%s/%s' file parsing failed",
-                                    MMapFile->getDir(), MMapFile->getName());
-                    fatal();
-                }
+                if (extension.equals(".modulemap_d"))
+                    parseModuleMap(path, Dir);
             }
-        }
-    };
+        };
+
+        for (size_t i = 0; i < SrcMgr.local_sloc_entry_size(); i++)
+            lookForModuleMap(SrcMgr.getLocalSLocEntry(i));
+        for (size_t i = 0; i < SrcMgr.loaded_sloc_entry_size(); i++)
+            lookForModuleMap(SrcMgr.getLoadedSLocEntry(i));
 
-    for (size_t i = 0; i < SrcMgr.local_sloc_entry_size(); i++)
-        lookForModuleMap(SrcMgr.getLocalSLocEntry(i));
-    for (size_t i = 0; i < SrcMgr.loaded_sloc_entry_size(); i++)
-        lookForModuleMap(SrcMgr.getLoadedSLocEntry(i));
+        if (!Diags->hasErrorOccurred())
+            writeModuleMapIndex(CheckedDirs, entryModuleMapFiles);
+    }
 
     // Since the out-of-dateness of headers are checked lazily for most of them, it might only be detected
     // by walking through all the SLoc entries. If an error occurred start over and trigger a loadFromHeaders.
@@ -911,27 +1872,48 @@ void PCH::update()
         delete MMap;
         AST = nullptr;
 
+        llvm::sys::fs::remove(pchFilename);
         needHeadersReload = true;
         return update();
     }
 
+    if (newModuleMapFiles)
+        writeCacheFile(calypso.getCacheFilename(".modulemaps"), [&] (llvm::raw_ostream& OS) {
+            for (auto& moduleMapFile: moduleMapFiles)
+                OS << moduleMapFile << "\n";
+        });
+
+    // Mark the cache entries of every PCH layer as used, then evict the least recently used ones
+    for (unsigned layer = 0; layer < headerLayers.size(); layer++)
+        touchCacheEntry(llvm::sys::path::parent_path(layerFilename(layer, ".h.pch", headers.dim)));
+    touchCacheEntry(calypso.cacheDir);
+
+    evictCacheEntries(calypso.cacheDir);
+    evictCacheEntries(opts::cppCacheDir.empty() ? "." : opts::cppCacheDir.c_str(), calypso.cachePrefix);
+
     // Build the builtin type map
     calypso.builtinTypes.build(AST->getASTContext());
 
-    // Since macros aren't sorted by file (unlike decls) we build a map of macros in order to only go through every macro once
-    calypso.buildMacroMap();
-
     // Initialize the mangling context
     MangleCtx = AST->getASTContext().createMangleContext();
 }
 
-void LangPlugin::buildMacroMap()
+// Since macros aren't sorted by file (unlike decls) we build an index of macros in order to only go through every macro once,
+// the first time a module gets imported
+void LangPlugin::buildMacroIndex()
 {
     auto& MMap = pch.MMap;
     auto& PP = getPreprocessor();
-    auto& Sema = getSema();
     auto& SM = getSourceManager();
 
+    macroIndexBuilt = true;
+
+    // Index the module headers by FileEntry, the first module listing a header owns it
+    llvm::DenseMap<const clang::FileEntry*, const clang::Module::Header*> HeaderIndex;
+    for (auto ModI = MMap->module_begin(), ModE = MMap->module_end(); ModI != ModE; ModI++)
+        for (auto& Header: ModI->getValue()->Headers[clang::Module::HK_Normal])
+            HeaderIndex.insert(std::make_pair(Header.Entry, &Header));
+
     for (auto I = PP.macro_begin(), E = PP.macro_end(); I != E; I++)
     {
         auto II = (*I).getFirst();
@@ -953,120 +1935,297 @@ void LangPlugin::buildMacroMap()
         auto MFileID = SM.getFileID(MLoc);
         auto MFileEntry = SM.getFileEntryForID(MFileID);
 
-        const clang::Module::Header *FoundHeader = nullptr;
-        for (auto ModI = MMap->module_begin(), ModE = MMap->module_end(); ModI != ModE; ModI++) {
-            for (auto& Header: ModI->getValue()->Headers[clang::Module::HK_Normal])
-                if (MFileEntry == Header.Entry) {
-                    FoundHeader = &Header; break;
-                }
-            if (FoundHeader) break;
+        auto FoundHeader = HeaderIndex.find(MFileEntry);
+        if (FoundHeader == HeaderIndex.end())
+            continue;
+
+        MacroIndex[FoundHeader->second].emplace_back(II, MInfo);
+    }
+}
+
+// Clang already uniques its identifiers, so each one only gets hashed and copied into DMD's StringTable once.
+// The copy can't be avoided since identifiers lexed from D code have to resolve to the same Identifier.
+LangPlugin::MappedIdentifier LangPlugin::mapIdentifier(const clang::IdentifierInfo *II)
+{
+    if (identifierMapAST != pch.AST)
+    {
+        IdentifierMap.clear();
+        identifierMapAST = pch.AST;
+    }
+
+    auto& Entry = IdentifierMap[II];
+    if (!Entry.ident)
+    {
+        auto ident = Identifier::idPool(II->getNameStart(), II->getLength());
+        Entry.ident = ident;
+        Entry.isReservedClassName = ident == Id::Object || ident == Id::Throwable || ident == Id::Exception || ident == Id::Error ||
+            ident == Id::TypeInfo || ident == Id::TypeInfo_Class || ident == Id::TypeInfo_Interface ||
+            ident == Id::TypeInfo_Struct || ident == Id::TypeInfo_Pointer ||
+            ident == Id::TypeInfo_Array || ident == Id::TypeInfo_StaticArray || ident == Id::TypeInfo_AssociativeArray ||
+            ident == Id::TypeInfo_Enum || ident == Id::TypeInfo_Function || ident == Id::TypeInfo_Delegate ||
+            ident == Id::TypeInfo_Tuple || ident == Id::TypeInfo_Const || ident == Id::TypeInfo_Invariant ||
+            ident == Id::TypeInfo_Shared || ident == Id::TypeInfo_Wild || ident == Id::TypeInfo_Vector; // thanks C++...
+    }
+
+    return Entry;
+}
+
+// Non-member overloaded operators are part of the module of the record or enum they take as operand.
+// Namespaces such as std have huge overload sets, so they get sorted by tag once for all the imports.
+const LangPlugin::TagOperatorsTy *LangPlugin::getTagOperators(const clang::DeclContext *DC,
+                                                              const clang::TagDecl *Tag)
+{
+    auto& Context = getASTContext();
+    DC = DC->getPrimaryContext();
+
+    auto Found = TagOperatorIndex.find(DC);
+    if (Found == TagOperatorIndex.end())
+    {
+        auto& Index = TagOperatorIndex[DC];
+
+        for (int Op = 1; Op < clang::NUM_OVERLOADED_OPERATORS; Op++)
+        {
+            auto OpName = Context.DeclarationNames.getCXXOperatorName(
+                        static_cast<clang::OverloadedOperatorKind>(Op));
+
+            for (auto OverOp: DC->lookup(OpName))
+                if (auto OpTag = isOverloadedOperatorWithTagOperand(OverOp))
+                    Index[OpTag->getCanonicalDecl()].emplace_back(Op, OverOp);
         }
 
-        if (!FoundHeader)
-            continue;
+        Found = TagOperatorIndex.find(DC);
+    }
 
-        auto& MacroMapEntry = MacroMap[FoundHeader];
-        if (!MacroMapEntry)
-            MacroMapEntry = new MacroMapEntryTy;
+    auto Operators = Found->second.find(Tag->getCanonicalDecl());
+    if (Operators == Found->second.end())
+        return nullptr;
 
-        auto ResultExpr = Sema.ActOnNumericConstant(Tok);
-        assert(!ResultExpr.isInvalid());
-        auto Expr = ResultExpr.get();
+    return &Operators->second;
+}
 
-        MacroMapEntry->emplace_back(II, Expr);
+// The values of the macros are only evaluated once the module containing the header gets mapped
+LangPlugin::MacroMapEntryTy *LangPlugin::getMacroMapEntry(const clang::Module::Header *Header)
+{
+    if (!macroIndexBuilt)
+        buildMacroIndex();
+
+    auto& MacroMapEntry = MacroMap[Header];
+    if (MacroMapEntry)
+        return MacroMapEntry;
+
+    auto IndexEntry = MacroIndex.find(Header);
+    if (IndexEntry == MacroIndex.end())
+        return nullptr;
+
+    auto& Sema = getSema();
+
+    MacroMapEntry = new MacroMapEntryTy;
+    for (auto& P: IndexEntry->second)
+    {
+        auto ResultExpr = Sema.ActOnNumericConstant(P.second->getReplacementToken(0));
+        assert(!ResultExpr.isInvalid());
+        MacroMapEntry->emplace_back(P.first, ResultExpr.get());
     }
+
+    MacroIndex.erase(IndexEntry);
+    return MacroMapEntry;
 }
 
 void PCH::save()
 {
-    if (!needSaving)
+    if (!AST)
         return;
 
-    if (AST->getASTContext().getExternalSource() != nullptr) // FIXME: Clang makes it hard to save a new PCH when an external source like another PCH is loaded by the ASTContext
+    if (!needSaving ||
+            (AST->getASTContext().getExternalSource() != nullptr && !chainWriter)) // FIXME: Clang makes it hard to save a new PCH when an external source like another PCH is loaded by the ASTContext
+    {
+        saveMangledNames(); // the DeclIDs stay valid as long as the PCH file isn't rewritten
         return;
+    }
 
     auto& PP = AST->getPreprocessor();
+    auto saveStart = std::chrono::steady_clock::now();
 
-    std::error_code EC;
-    llvm::raw_fd_ostream OS(pchFilename, EC, llvm::sys::fs::F_None);
+    // Other compilations may be reading the current PCH file, so the new one is written to a temporary file and renamed
+    int FD;
+    llvm::SmallString<128> tmpFilename;
+    if (llvm::sys::fs::createUniqueFile(pchFilename + "-%%%%%%%%.tmp", FD, tmpFilename))
+    {
+        ::error(Loc(), "Temporary PCH file couldn't be created");
+        fatal();
+    }
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/ true);
 
     auto& Sysroot = PP.getHeaderSearchInfo().getHeaderSearchOpts().Sysroot;
-    auto Buffer = std::make_shared<clang::PCHBuffer>();
     auto *Writer = PCHContainerOps->getWriterOrNull("raw");
 
-    auto GenPCH = new clang::PCHGenerator(PP, pchFilename,
-                                          nullptr, Sysroot, Buffer,
-                                          llvm::ArrayRef<llvm::IntrusiveRefCntPtr<clang::ModuleFileExtension>>(),
-                                          true);
-    GenPCH->InitializeSema(AST->getSema());
-
     std::vector<std::unique_ptr<clang::ASTConsumer>> Consumers;
-    Consumers.push_back(std::unique_ptr<clang::ASTConsumer>(GenPCH));
+    std::shared_ptr<clang::PCHBuffer> Buffer;
+    if (chainWriter)
+    {
+        // Only the declarations and types of the new layer get written
+        chainWriter->write(AST->getSema(), pchFilename, Sysroot);
+        Buffer = chainWriter->Buffer;
+        chainWriter = nullptr; // an ASTWriter only writes once, later instantiations stay out of the layer like with a loaded PCH
+    }
+    else
+    {
+        Buffer = std::make_shared<clang::PCHBuffer>();
+        auto GenPCH = new clang::PCHGenerator(PP, pchFilename,
+                                              nullptr, Sysroot, Buffer,
+                                              llvm::ArrayRef<llvm::IntrusiveRefCntPtr<clang::ModuleFileExtension>>(),
+                                              true);
+        GenPCH->InitializeSema(AST->getSema());
+        Consumers.push_back(std::unique_ptr<clang::ASTConsumer>(GenPCH));
+    }
+
     Consumers.push_back(Writer->CreatePCHContainerGenerator(
         *static_cast<clang::CompilerInstance*>(nullptr), pchHeader, pchFilename, &OS, Buffer));
 
     auto Mutiplex = llvm::make_unique<clang::MultiplexConsumer>(std::move(Consumers));
     Mutiplex->HandleTranslationUnit(AST->getASTContext());
 
+    auto bytesWritten = OS.tell();
+    OS.close();
+    if (llvm::sys::fs::rename(tmpFilename, pchFilename))
+    {
+        llvm::sys::fs::remove(tmpFilename);
+        ::error(Loc(), "PCH file %s couldn't be replaced", pchFilename.c_str());
+        fatal();
+    }
+
     needSaving = false;
+    pchStamp.clear(); // the DeclIDs changed
+    llvm::sys::fs::remove(calypso.getCacheEntryFilename(moduleDeclsSuffix), true);
+    llvm::sys::fs::remove(calypso.getCacheEntryFilename(mangledNamesSuffix), true);
+
+    std::chrono::duration<double> saveTime = std::chrono::steady_clock::now() - saveStart;
+    if (global.params.verbose)
+        fprintf(global.stdmsg, "cpp-pch   %s (%llu bytes written in %.3fs)\n", pchFilename.c_str(),
+                (unsigned long long) bytesWritten, saveTime.count());
 }
 
-void LangPlugin::GenModSet::parse()
+void LangPlugin::printStats()
 {
-    if (parsed)
+    if (!pch.AST)
         return;
 
-    parsed = true;
-    clear();
-
-    auto genFilename = calypso.getCacheFilename(".gen");
-    if (!llvm::sys::fs::exists(genFilename))
+    fprintf(global.stdmsg, "cpp-stats PCH %s\n", pch.pchFilename.c_str());
+    fprintf(global.stdmsg, "cpp-stats %u Clang module imports mapped in %.3fs\n",
+            stats.clangModuleImports, stats.clangModuleMapTime);
+    fprintf(global.stdmsg, "cpp-stats %u module imports with cached declarations, %.3fs of lookups saved\n",
+            stats.cachedModuleImports, stats.moduleLookupTimeSaved);
+    fprintf(global.stdmsg, "cpp-stats %u declarations mangled, %u mangled names reused from the cache\n",
+            stats.mangledNames, stats.cachedMangledNames);
+    fprintf(global.stdmsg, "cpp-stats %u C++ template instances requested, %u found in the instance table\n",
+            stats.templateInstHits + stats.templateInstMisses, stats.templateInstHits);
+    fprintf(global.stdmsg, "cpp-stats %u function template substitution failures\n",
+            stats.templateInstFailures);
+    fprintf(global.stdmsg, "cpp-stats %u CodeGenModule for %u modules, set up in %.3fs and released in %.3fs\n",
+            stats.codegenModules, stats.codegenDModules, stats.codegenSetupTime, stats.codegenReleaseTime);
+
+#if __linux__
+    // Sum up the resident memory of the PCH mappings, split between the pages shared with other processes and the private ones
+    auto fsmaps = fopen("/proc/self/smaps", "r");
+    if (!fsmaps)
         return;
 
-    auto fgenList = fopen(genFilename.c_str(), "r"); // ordered list of headers
-    if (!fgenList)
-    {
-        ::error(Loc(), "Reading .gen file failed");
-        fatal();
-    }
+    unsigned long long pchShared = 0, pchPrivate = 0, totalPrivate = 0;
+    bool inPCHMapping = false;
 
     char linebuf[MAX_FILENAME_SIZE];
-    while (fgets(linebuf, sizeof(linebuf), fgenList) != NULL)
+    while (fgets(linebuf, sizeof(linebuf), fsmaps) != NULL)
     {
-        linebuf[strcspn(linebuf, "\n")] = '\0';
-        if (linebuf[0] == '\0')
+        char key[64];
+        unsigned long long kb;
+
+        if (sscanf(linebuf, "%63[A-Za-z_]: %llu kB", key, &kb) != 2)
+        {
+            // Mapping header line: address range, permissions, offset, device, inode then the optional path
+            inPCHMapping = strstr(linebuf, ".pch") != nullptr;
             continue;
+        }
+
+        bool isShared = strncmp(key, "Shared_", 7) == 0,
+            isPrivate = strncmp(key, "Private_", 8) == 0;
 
-        if (llvm::sys::fs::exists(linebuf))
-            insert(strdup(linebuf));
+        if (isPrivate)
+            totalPrivate += kb;
+
+        if (inPCHMapping)
+        {
+            if (isShared) pchShared += kb;
+            else if (isPrivate) pchPrivate += kb;
+        }
     }
 
-    fclose(fgenList);
+    fclose(fsmaps);
+
+    fprintf(global.stdmsg, "cpp-stats PCH mapping: %llu kB shared, %llu kB private\n", pchShared, pchPrivate);
+    fprintf(global.stdmsg, "cpp-stats process private memory: %llu kB\n", totalPrivate);
+#endif
+}
+
+void LangPlugin::GenModSet::parse()
+{
+    if (parsed)
+        return;
+
+    parsed = true;
+    clear();
+
+    auto Buf = llvm::MemoryBuffer::getFile(calypso.getCacheEntryFilename(".gen"));
+    if (!Buf)
+        return;
+
+    forEachCacheRecord((*Buf)->getBuffer(), [&] (llvm::StringRef Line) {
+        llvm::StringRef ObjName, References;
+        std::tie(ObjName, References) = Line.split('\t');
+
+        if (llvm::sys::fs::exists(ObjName))
+            (*this)[ObjName] = References.str();
+    });
+}
+
+// The object file of a lazily mapped namespace module only holds what the compilation that generated it looked up,
+// so it can't be reused by compilations which may look up other names
+static bool isCodegenReusable(::Module *m)
+{
+    return !static_cast<cpp::Module*>(m)->lazyDC;
 }
 
 void LangPlugin::GenModSet::add(::Module *m)
 {
+    if (!isCodegenReusable(m))
+        return;
+
     auto& objName = m->objfile->name->str;
     assert(parsed && !count(objName));
 
-    auto genFilename = calypso.getCacheFilename(".gen");
-    auto fgenList = fopen(genFilename.c_str(), "a");
-    if (!fgenList)
+    // The modules referenced by the function bodies have to be loaded by the compilations reusing the object file
+    std::string references;
+    for (auto& modName: static_cast<cpp::Module*>(m)->referencedModules)
     {
-        ::error(Loc(), "Writing .gen file failed");
-        fatal();
+        if (!references.empty())
+            references += ' ';
+        references += modName.getKey();
     }
 
-    fprintf(fgenList, "%s\n", objName);
-    fclose(fgenList);
+    std::string record;
+    llvm::raw_string_ostream OS(record);
+    writeCacheRecord(OS, (llvm::Twine(objName) + "\t" + references).str());
+    appendCacheRecords(calypso.getCacheEntryFilename(".gen"), OS.str());
 
-    insert(objName);
+    (*this)[objName] = references;
 }
 
 bool LangPlugin::needsCodegen(::Module *m)
 {
     assert(isCPP(m));
 
+    if (!isCodegenReusable(m))
+        return true;
+
     genModSet.parse();
 
     auto& objName = m->objfile->name->str;
@@ -1186,7 +2345,23 @@ std::string LangPlugin::getCacheFilename(const char *suffix)
     using namespace llvm::sys::path;
 
     std::string fn(calypso.cachePrefix);
-    llvm::SmallString<128> fullpath(opts::cppCacheDir);
+    llvm::SmallString<128> fullpath(cacheDir);
+
+    if (suffix)
+        fn += suffix;
+    append(fullpath, fn);
+
+    return fullpath.str().str();
+}
+
+std::string LangPlugin::getCacheEntryFilename(const char *suffix)
+{
+    using namespace llvm::sys::path;
+
+    assert(!pch.entryDir.empty());
+
+    std::string fn(calypso.cachePrefix);
+    llvm::SmallString<128> fullpath(pch.entryDir);
 
     if (suffix)
         fn += suffix;
@@ -12,7 +12,11 @@
 #include "../gen/cgforeign.h"
 
 #include <memory>
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/FoldingSet.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/IR/DataLayout.h"
 #include "clang/AST/ASTMutationListener.h"
 #include "clang/Basic/SourceLocation.h"
@@ -34,9 +38,17 @@ class ASTUnit;
 class MacroInfo;
 class ModuleMap;
 class PCHContainerOperations;
+class FileEntry;
+class DirectoryEntry;
+class CompilerInvocation;
 namespace driver { class Compilation; }
 }
 
+namespace llvm
+{
+class LockFileManager;
+}
+
 namespace cpp
 {
 
@@ -87,8 +99,11 @@ public:
 
     void CompletedImplicitDefinition(const clang::FunctionDecl *D) override;
     void FunctionDefinitionInstantiated(const clang::FunctionDecl *D) override;
+    void AddedCXXImplicitMember(const clang::CXXRecordDecl *RD, const clang::Decl *D) override;
 };
 
+class ChainedPCHWriter;
+
 class DiagMuter
 {
 public:
@@ -101,7 +116,10 @@ class PCH
 public:
     Strings headers; // array of all C/C++ header names with the "" or <>, required as long as we're using a PCH
             // the array is initialized at the first Modmap::semantic and kept in sync with a cache file named 'calypso_cache.list'
-            // TODO: it's currently pretty basic and dumb and doesn't check whether the same header might be named differently or is already included by another
+            // new headers resolving to a file already included by the PCH get dropped by update()
+    llvm::StringSet<> headerSet; // every header name added so far, including the dropped ones
+    llvm::SmallVector<unsigned, 4> headerLayers; // index of the first header of each PCH layer, the first one being the base PCH and the next ones chained PCHs (-cpp-chainpch)
+    unsigned numCachedHeaders = 0; // number of headers read from the cached list, i.e already in the PCH
     bool needHeadersReload = false;
     ASTUnit *AST = nullptr;
     clang::MangleContext *MangleCtx = nullptr;
@@ -111,6 +129,8 @@ public:
     std::shared_ptr<clang::PCHContainerOperations> PCHContainerOps;
     
     ModuleMap *MMap = nullptr;
+    const llvm::SmallVectorImpl<clang::FileID> &getFileIDs(const clang::FileEntry *File); // every FileID of a file, headers without include guard may have several
+    std::vector<std::string> moduleMapFiles; // every .modulemap_d file found so far, cached in 'calypso_cache.modulemaps'
 
     void init(); // load the list of headers already cached in the PCH
     void add(const char* header, ::Module *from);
@@ -118,17 +138,66 @@ public:
     void update(); // re-emit the PCH if needed, and update the cached list
 
     bool needSaving = false;
-    void save();
+    void save(); // write the instantiations done by DMD back into the PCH, called once at the end of the compilation
+
+    // Declarations making up each C++ module and their DeclMapper flags, cached by global DeclID in 'calypso_cache.moddecls'
+    // so that the next compilations loading the same PCH file don't have to look for them again
+    typedef std::vector<std::pair<const clang::Decl*, unsigned>> ModuleDeclsTy;
+    bool loadModuleDecls(llvm::StringRef moduleName, ModuleDeclsTy &Decls, double &lookupTime);
+    void saveModuleDecls(llvm::StringRef moduleName, const ModuleDeclsTy &Decls, double lookupTime);
+
+    // Mangled names of the PCH declarations, cached by global DeclID in 'calypso_cache.mangles' (-cpp-manglecache)
+    const char *getCachedMangledName(const clang::Decl *D);
+    void addMangledName(const clang::Decl *D, const char *Name);
 
     std::string pchHeader;
     std::string pchFilename;
+    std::string entryDir; // cache directory of the current header set
+    void markEntriesInUse();
 //     std::string pchFilenameNew; // the PCH may be updated by Calypso, but into a different file since the original PCH is still opened as external source for the ASTContext
 
     int cxxStdlibType;
 
+    static const unsigned maxLayers = 8; // beyond that the chain gets consolidated by a full reparse
+
 protected:
-    void loadFromHeaders(clang::driver::Compilation* C);
-    void loadFromPCH(clang::driver::Compilation* C);
+    llvm::StringMap<std::shared_ptr<llvm::LockFileManager>> inUseLocks; // held until exit, see markEntriesInUse()
+
+    bool chainedLayer = false; // true if the AST was parsed on top of a cached PCH
+    ChainedPCHWriter *chainWriter = nullptr; // owned by the ASTUnit
+    bool chainingFailed = false;
+
+    std::string entryDirFor(unsigned numHeaders);
+    std::string layerFilename(unsigned layer, const char *suffix, unsigned numHeaders);
+    bool loadFromHeaders(clang::driver::Compilation* C, const char *basePCH = nullptr);
+    bool loadFromPCH(clang::driver::Compilation* C);
+    void prebuildModules(const clang::CompilerInvocation &CI);
+
+    bool loadModuleMapIndex(llvm::function_ref<void(llvm::StringRef, const clang::DirectoryEntry*)> parseModuleMap);
+    void writeModuleMapIndex(const llvm::DenseSet<const clang::DirectoryEntry*> &Dirs,
+                             const std::vector<std::string> &entryModuleMapFiles);
+
+    llvm::DenseMap<const clang::FileEntry*, llvm::SmallVector<clang::FileID, 1>> FileIDIndex; // built on first use
+    bool fileIDIndexBuilt = false;
+
+    std::string pchStamp; // size and modification time of the PCH file the AST was loaded from, empty if parsed from headers
+    bool moduleDeclsParsed = false;
+    llvm::StringMap<std::pair<double, std::vector<std::pair<unsigned, unsigned>>>> moduleDeclIDs;
+
+    bool mangledNamesParsed = false;
+    llvm::BumpPtrAllocator MangledNamesAlloc;
+    llvm::DenseMap<unsigned, const char*> cachedMangledNames;
+    std::vector<std::pair<unsigned, const char*>> newMangledNames; // appended to the file by save()
+    void saveMangledNames();
+
+    llvm::DenseSet<const clang::FileEntry*> includedFiles; // files entered by the preprocessor while building the AST
+    ASTUnit *includedFilesAST = nullptr;
+
+    const clang::FileEntry *lookupHeader(const char *header);
+    bool isIncluded(const clang::FileEntry *File);
+    void pruneIncludedHeaders();
+    void saveHeaderAliases(llvm::ArrayRef<llvm::StringRef> aliases);
+    void writeHeaderList();
 };
 
 class LangPlugin : public ::LangPlugin, public ::ForeignCodeGen
@@ -176,6 +245,8 @@ public:
 
     void enterModule(::Module *m, llvm::Module *) override;
     void leaveModule(::Module *m, llvm::Module *) override;
+    void releaseModule(llvm::Module *lm) override;
+    void moduleWritten(::Module *m) override;
 
     void enterFunc(::FuncDeclaration *fd) override;
     void leaveFunc() override;
@@ -221,10 +292,45 @@ public:
          
     // ==== ==== ====
     PCH pch;
-    llvm::MapVector<const clang::Decl*, std::string> MangledDeclNames;
+
+    struct
+    {
+        unsigned clangModuleImports = 0;
+        double clangModuleMapTime = 0; // in seconds
+        unsigned cachedModuleImports = 0; // modules whose declarations came from 'calypso_cache.moddecls'
+        double moduleLookupTimeSaved = 0;
+        unsigned mangledNames = 0;
+        unsigned cachedMangledNames = 0; // from 'calypso_cache.mangles'
+        unsigned templateInstHits = 0;
+        unsigned templateInstMisses = 0;
+        unsigned templateInstFailures = 0; // substitution failures of function template candidates
+        unsigned codegenModules = 0; // CodeGenModule instances
+        unsigned codegenDModules = 0; // D modules emitted through them
+        double codegenSetupTime = 0;
+        double codegenReleaseTime = 0;
+    } stats; // -cpp-stats
+    llvm::BumpPtrAllocator MangledDeclNamesAlloc;
+    llvm::DenseMap<const clang::Decl*, const char*> MangledDeclNames;
+    llvm::DenseMap<const clang::Decl*, Dsymbol*> MappedSymbols; // see getMappedSymbol()
+
+    // C++ template instances requested by DMD during this compilation, keyed by primary template and canonical arguments
+    // (null if the substitution failed)
+    struct TemplateInstEntry : public llvm::FoldingSetNode
+    {
+        llvm::FoldingSetNodeIDRef Key; // lookups use a transient ID, only inserted entries intern theirs
+        clang::NamedDecl *Inst;
+
+        TemplateInstEntry(llvm::FoldingSetNodeIDRef Key, clang::NamedDecl *Inst) : Key(Key), Inst(Inst) {}
+        void Profile(llvm::FoldingSetNodeID &ID) const {
+            for (size_t i = 0; i < Key.getSize(); i++)
+                ID.AddInteger(Key.getData()[i]);
+        }
+    };
+    llvm::FoldingSet<TemplateInstEntry> TemplateInsts;
+    llvm::BumpPtrAllocator TemplateInstsAlloc;
 
     typedef std::vector<std::pair<const clang::IdentifierInfo*, clang::Expr*>> MacroMapEntryTy;
-    llvm::DenseMap<const clang::Module::Header*, MacroMapEntryTy*> MacroMap;
+    llvm::DenseMap<const clang::Module::Header*, MacroMapEntryTy*> MacroMap; // filled lazily by getMacroMapEntry()
 
     BuiltinTypes &builtinTypes;
     DeclReferencer &declReferencer;
@@ -234,7 +340,7 @@ public:
 
     std::string executablePath; // from argv[0] to locate Clang builtin headers
 
-    struct GenModSet : public llvm::StringSet<> // already compiled modules
+    struct GenModSet : public llvm::StringMap<std::string> // already compiled modules, mapped to the modules referenced by their bodies
     {
         bool parsed = false;
 
@@ -244,13 +350,25 @@ public:
 
     // settings
     const char *cachePrefix = "calypso_cache"; // prefix of cached files (list of headers, PCH)
+    std::string cacheDir; // subdirectory of -cpp-cachedir specific to the -cpp-args, target and Clang version
 
+    std::unique_ptr<clang::CodeGenOptions> CGOpts;
     std::unique_ptr<clangCG::CodeGenModule> CGM;  // selectively emit external C++ declarations, template instances, ...
+                                                  // lives as long as its llvm::Module, see releaseModule()
 
     LangPlugin();
     void init(const char *Argv0);
 
-    void buildMacroMap();
+    MacroMapEntryTy *getMacroMapEntry(const clang::Module::Header *Header);
+    typedef llvm::SmallVector<std::pair<int, const clang::NamedDecl*>, 4> TagOperatorsTy; // (OverloadedOperatorKind, operator)
+    const TagOperatorsTy *getTagOperators(const clang::DeclContext *DC, const clang::TagDecl *Tag);
+    struct MappedIdentifier
+    {
+        Identifier *ident = nullptr;
+        bool isReservedClassName = false; // name of a druntime class, C++ records named like it get prefixed with '§'
+    };
+    MappedIdentifier mapIdentifier(const clang::IdentifierInfo *II);
+    void printStats(); // -cpp-stats
 
     ASTUnit *getASTUnit() { return pch.AST; }
     clang::ASTContext &getASTContext();
@@ -259,7 +377,8 @@ public:
     clang::Preprocessor &getPreprocessor();
     clang::SourceManager &getSourceManager();
 
-    std::string getCacheFilename(const char *suffix = nullptr);
+    std::string getCacheFilename(const char *suffix = nullptr); // in cacheDir
+    std::string getCacheEntryFilename(const char *suffix); // in the cache entry of the current header set
 
     // FIXME quick&dirty traits addition
     Expression *semanticTraits(TraitsExp *e, Scope *sc);
@@ -267,6 +386,18 @@ public:
 private:
     void updateCGFInsertPoint();    // CGF has its own IRBuilder, it's not an issue if we set its insert point correctly
 
+    void buildMacroIndex();
+    bool macroIndexBuilt = false;
+    typedef std::vector<std::pair<const clang::IdentifierInfo*, const clang::MacroInfo*>> MacroIndexEntryTy;
+    llvm::DenseMap<const clang::Module::Header*, MacroIndexEntryTy> MacroIndex; // macros of each module header not mapped yet
+
+    typedef llvm::DenseMap<const clang::TagDecl*, TagOperatorsTy> TagOperatorIndexTy;
+    llvm::DenseMap<const clang::DeclContext*, TagOperatorIndexTy> TagOperatorIndex; // built once per namespace by getTagOperators()
+
+    // The FETokenInfo slot of IdentifierInfo is taken by Sema's IdResolver, hence the side table
+    llvm::DenseMap<const clang::IdentifierInfo*, MappedIdentifier> IdentifierMap;
+    ASTUnit *identifierMapAST = nullptr;
+
     // Keep the existing LLVM types generated by CodeGenTypes between modules
     llvm::DenseMap<const clang::Type*, clangCG::CGRecordLayout*> CGRecordLayouts;
     llvm::DenseMap<const clang::Type*, llvm::StructType*> RecordDeclTypes;
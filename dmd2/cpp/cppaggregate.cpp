@@ -3,6 +3,7 @@
 #include "cpp/calypso.h"
 #include "cpp/cppaggregate.h"
 #include "cpp/cppdeclaration.h"
+#include "cpp/cppmodule.h"
 #include "cpp/cpptemplate.h"
 #include "attrib.h"
 #include "scope.h"
@@ -67,6 +68,193 @@ IMPLEMENT_syntaxCopy(StructDeclaration, RD)
 IMPLEMENT_syntaxCopy(ClassDeclaration, RD)
 IMPLEMENT_syntaxCopy(UnionDeclaration, RD)
 
+// Records such as QWidget or std::basic_string have hundreds of methods and nested declarations
+// and D code only uses a handful of them, so these get mapped by search() whenever their name is looked up.
+bool hasLazyMembers(const clang::RecordDecl *RD)
+{
+    auto CRD = dyn_cast<clang::CXXRecordDecl>(RD);
+    return CRD && !CRD->isUnion() && !CRD->isAnonymousStructOrUnion() &&
+        CRD->isCompleteDefinition() && !CRD->isDependentContext();
+}
+
+bool isLazyRecordMember(const clang::Decl *D)
+{
+    if (auto FTD = dyn_cast<clang::FunctionTemplateDecl>(D))
+        D = FTD->getTemplatedDecl();
+
+    if (auto MD = dyn_cast<clang::CXXMethodDecl>(D))
+    {
+        if (isa<clang::CXXConstructorDecl>(MD) ||
+                MD->isCopyAssignmentOperator() || MD->isMoveAssignmentOperator())
+            return MD->isImplicit(); // declared by Sema when DMD looks for ctors or opAssign
+
+        return !MD->isVirtual() && !isa<clang::CXXDestructorDecl>(MD) &&
+            !isa<clang::CXXConversionDecl>(MD) && !MD->isOverloadedOperator(); // operators share D identifiers
+    }
+
+    if (auto Tag = dyn_cast<clang::TagDecl>(D))
+        return Tag->getIdentifier(); // anonymous tags may be part of the layout, and typedef'd ones are named after the typedef
+
+    return isa<clang::VarDecl>(D) || isa<clang::TypedefNameDecl>(D) ||
+        isa<clang::RedeclarableTemplateDecl>(D);
+}
+
+static Scope *lazyMemberScope(::AggregateDeclaration *ad, Scope *sc)
+{
+    // same as the scope of members created by AggregateDeclaration::semantic
+    auto sc2 = sc->push(ad);
+    sc2->stc &= STCsafe | STCtrusted | STCsystem;
+    sc2->parent = ad;
+    sc2->protection = Prot(PROTpublic);
+    sc2->explicitProtection = 0;
+    sc2->structalign = STRUCTALIGN_DEFAULT;
+    sc2->userAttribDecl = NULL;
+    return sc2;
+}
+
+template<typename AggTy>
+ void mapLazyMembers(AggTy *ad, Identifier *ident)
+{
+    if (!hasLazyMembers(ad->RD) || ad->lazyComplete || !ad->lazyIdents.insert(ident).second)
+        return;
+
+    auto& Context = calypso.getASTContext();
+    auto& S = calypso.getSema();
+    auto CRD = const_cast<clang::CXXRecordDecl *>(cast<clang::CXXRecordDecl>(ad->RD));
+
+    clang::DeclContext::lookup_result R;
+    if (ident == Id::ctor)
+    {
+        S.LookupDefaultConstructor(CRD);
+        for (int i = 0; i < 2; i++)
+            S.LookupCopyingConstructor(CRD, i ? clang::Qualifiers::Const : 0);
+
+        R = CRD->lookup(Context.DeclarationNames.getCXXConstructorName(
+                            Context.getCanonicalType(Context.getRecordType(CRD))));
+    }
+    else if (ident == Id::assign)
+    {
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 2; j++)
+                for (int k = 0; k < 2; k++)
+                    S.LookupCopyingAssignment(CRD, i ? clang::Qualifiers::Const : 0, j ? true : false,
+                                              k ? clang::Qualifiers::Const : 0);
+
+        R = CRD->lookup(Context.DeclarationNames.getCXXOperatorName(clang::OO_Equal));
+    }
+    else
+    {
+        const char prefix[] = u8"§";
+        bool prefixed = strncmp(ident->string, prefix, sizeof(prefix)-1) == 0;
+        llvm::StringRef Name(!prefixed ? ident->string : ident->string + sizeof(prefix)-1);
+
+        // Most of the names DMD searches (__dtor, opEquals, toHash...) aren't C++ identifiers, so don't create them
+        clang::IdentifierInfo *II = nullptr;
+        auto FoundII = Context.Idents.find(Name);
+        if (FoundII != Context.Idents.end())
+            II = FoundII->getValue();
+        else if (auto External = Context.Idents.getExternalIdentifierLookup())
+            II = External->get(Name); // only returns the identifiers present in the PCH
+        if (!II)
+            return;
+
+        R = CRD->lookup(clang::DeclarationName(II));
+    }
+
+    auto m = static_cast<cpp::Module*>(ad->getModule());
+    assert(isCPP(m));
+
+    DeclMapper mapper(m);
+    mapper.rebuildScope(CRD);
+
+    auto syms = new Dsymbols;
+    for (auto Match: R)
+    {
+        if (auto ECD = dyn_cast<clang::EnumConstantDecl>(Match))
+            Match = cast<clang::NamedDecl>(ECD->getDeclContext());
+
+        if (cast<clang::Decl>(Match->getDeclContext())->getCanonicalDecl() != CRD->getCanonicalDecl())
+            continue;  // only map declarations that are semantically within the record
+
+        auto D = getCanonicalDecl(Match);
+        if (!isLazyRecordMember(D) || !ad->lazyDecls.insert(D).second)
+            continue;
+
+        if (auto s = mapper.VisitDecl(D))
+            syms->append(s);
+    }
+
+    if (!syms->dim)
+        return;
+
+    ad->members->append(syms);
+    if (!ad->symtab)
+        return; // semantic() will add them
+
+    m->processLateImports();
+
+    assert(ad->lazyScope);
+    auto sc2 = lazyMemberScope(ad, ad->lazyScope);
+    addLateMembers(ad, sc2, syms, std::max(PASSsemantic, m->semanticRun));
+    sc2->pop();
+}
+
+template<typename AggTy>
+ void completeLazyMembers(AggTy *ad)
+{
+    if (!hasLazyMembers(ad->RD) || ad->lazyComplete)
+        return;
+
+    mapLazyMembers(ad, Id::ctor);
+    mapLazyMembers(ad, Id::assign);
+
+    for (auto D: ad->RD->decls())
+    {
+        auto ND = dyn_cast<clang::NamedDecl>(D);
+        if (ND && ND->getIdentifier() && isLazyRecordMember(ND))
+            mapLazyMembers(ad, fromIdentifier(ND->getIdentifier()));
+    }
+
+    ad->lazyComplete = true;
+}
+
+template<typename AggTy>
+ void prepareLazyMembers(AggTy *ad, Scope *sc)
+{
+    if (ad->lazyScope || !hasLazyMembers(ad->RD))
+        return;
+
+    ad->lazyScope = ad->scope ? ad->scope : sc;
+    ad->lazyScope->setNoFree();
+
+    // semantic() needs the constructors (and opAssign for structs) before the size gets finalized
+    mapLazyMembers(ad, Id::ctor);
+    if (ad->isStructDeclaration())
+        mapLazyMembers(ad, Id::assign);
+}
+
+Dsymbol *StructDeclaration::search(Loc loc, Identifier *ident, int flags)
+{
+    mapLazyMembers(this, ident);
+    return ::StructDeclaration::search(loc, ident, flags);
+}
+
+void StructDeclaration::completeMembers()
+{
+    completeLazyMembers(this);
+}
+
+Dsymbol *ClassDeclaration::search(Loc loc, Identifier *ident, int flags)
+{
+    mapLazyMembers(this, ident);
+    return ::ClassDeclaration::search(loc, ident, flags);
+}
+
+void ClassDeclaration::completeMembers()
+{
+    completeLazyMembers(this);
+}
+
 void StructDeclaration::semantic(Scope *sc)
 {
     if (semanticRun >= PASSsemanticdone)
@@ -95,6 +283,7 @@ void StructDeclaration::semantic(Scope *sc)
         instsd->syntaxCopy(this);
     }
 
+    prepareLazyMembers(this, sc);
     ::StructDeclaration::semantic(sc);
 }
 
@@ -151,6 +340,7 @@ void ClassDeclaration::semantic(Scope *sc)
         instcd->syntaxCopy(this);
     }
 
+    prepareLazyMembers(this, sc);
     ::ClassDeclaration::semantic(sc);
 
     // Build a copy ctor alias after scope setting and semantic'ing the C++ copy ctor during which its type is adjusted
@@ -461,6 +651,13 @@ const clang::RecordDecl *getRecordDecl(::Type *t)
 
     auto ident = getExtendedIdentifier(FD, tmap);
 
+    if (auto c_sd = ad->isStructDeclaration())
+        if (isCPP(c_sd) && !c_sd->isUnionDeclaration())
+            mapLazyMembers(static_cast<StructDeclaration*>(c_sd), ident);
+    if (auto c_cd = ad->isClassDeclaration())
+        if (isCPP(c_cd))
+            mapLazyMembers(static_cast<ClassDeclaration*>(c_cd), ident);
+
     auto s = ad->ScopeDsymbol::search(ad->loc, ident);
     if (s && s->isFuncDeclaration())
     {
@@ -12,6 +12,8 @@
 #include "../aggregate.h"
 #include "../attrib.h"
 
+#include "llvm/ADT/DenseSet.h"
+
 namespace clang
 {
 class RecordDecl;
@@ -33,10 +35,18 @@ public:
     const clang::RecordDecl *RD;
     bool layoutQueried = false;
 
+    // Methods and nested declarations mapped on first search, see hasLazyMembers()
+    Scope *lazyScope = nullptr;
+    llvm::DenseSet<Identifier *> lazyIdents;
+    llvm::DenseSet<const clang::Decl *> lazyDecls;
+    bool lazyComplete = false;
+
     StructDeclaration(Loc loc, Identifier* id, const clang::RecordDecl* RD);
     StructDeclaration(const StructDeclaration&);
     Dsymbol *syntaxCopy(Dsymbol *s) override;
     void semantic(Scope *sc) override;
+    Dsymbol *search(Loc loc, Identifier *ident, int flags = IgnoreNone) override;
+    void completeMembers() override;
     void buildLayout() override;
     void finalizeSize(Scope *sc) override;
     Expression *defaultInit(Loc loc) override;
@@ -54,11 +64,18 @@ public:
     const clang::CXXRecordDecl *RD;
     bool layoutQueried = false;
 
+    Scope *lazyScope = nullptr;
+    llvm::DenseSet<Identifier *> lazyIdents;
+    llvm::DenseSet<const clang::Decl *> lazyDecls;
+    bool lazyComplete = false;
+
     ClassDeclaration(Loc loc, Identifier *id, BaseClasses *baseclasses,
                      const clang::CXXRecordDecl *RD);
     ClassDeclaration(const ClassDeclaration&);
     Dsymbol *syntaxCopy(Dsymbol *s) override;
     void semantic(Scope *sc) override;
+    Dsymbol *search(Loc loc, Identifier *ident, int flags = IgnoreNone) override;
+    void completeMembers() override;
     void buildLayout() override;
     bool mayBeAnonymous() override;
     
@@ -101,6 +118,9 @@ public:
     Dsymbol *syntaxCopy(Dsymbol *s) override;
 };
 
+bool hasLazyMembers(const clang::RecordDecl *RD); // only fields, bases and virtual methods get mapped upfront
+bool isLazyRecordMember(const clang::Decl *D);
+
 const clang::RecordDecl *getRecordDecl(::AggregateDeclaration *ad);
 const clang::RecordDecl *getRecordDecl(::Type *t);
 ::FuncDeclaration *findMethod(::AggregateDeclaration *ad, const clang::FunctionDecl *FD);
@@ -3,6 +3,7 @@
 #include "cpp/calypso.h"
 #include "cpp/cppdeclaration.h"
 #include "cpp/cppexpression.h"
+#include "cpp/cppmodule.h"
 #include "cpp/cpptemplate.h"
 #include "aggregate.h"
 #include "init.h"
@@ -76,6 +77,12 @@ FuncDeclaration::FuncDeclaration(const FuncDeclaration& o)
             return 0;
         }
     };
+    // The symbol mapped from FD is almost always the one in this overload set, i.e unless it's a copy
+    if (auto s = getMappedSymbol(FD))
+        if (auto f = s->isFuncDeclaration())
+            if (getFD(f) == FD && f->toParent() == fd->toParent())
+                return f;
+
     FDEquals p;
     p.FD = FD;
     p.f = nullptr;
@@ -204,11 +211,95 @@ Scope *globalScope(::Module *m)
     return sc;
 }
 
-void DeclReferencer::Traverse(Loc loc, Scope *sc, clang::Stmt *S)
+// Referencing a function template instance may instantiate it and reference its own callees, their bodies get queued
+// and traversed by the outermost call instead of recursively
+void DeclReferencer::Traverse(Loc loc, Scope *sc, const clang::FunctionDecl *FD)
 {
-    this->loc = loc;
-    this->sc = sc;
-    TraverseStmt(S);
+    if (!Queued.insert(FD->getCanonicalDecl()).second)
+        return;
+
+    Worklist.push_back({loc, sc, FD});
+    if (draining)
+        return;
+
+    draining = true;
+    while (!Worklist.empty())
+    {
+        auto Item = Worklist.pop_back_val();
+        this->loc = Item.loc;
+        this->sc = Item.sc;
+
+        const clang::FunctionDecl *Def;
+        if (Item.FD->isInvalidDecl() || !Item.FD->hasBody(Def))
+            continue;
+
+        TraverseStmt(Def->getBody());
+
+        if (auto Ctor = dyn_cast<clang::CXXConstructorDecl>(Def))
+            for (auto& Init: Ctor->inits())
+                TraverseStmt(Init->getInit());
+    }
+    draining = false;
+}
+
+// Fallback for the decls without a mapped symbol yet: ensure that the module gets imported and let DMD resolve the symbol
+Dsymbol *DeclReferencer::ReferenceThroughImport(const clang::NamedDecl *D, const clang::NamedDecl *ImportD)
+{
+    // Although we try to add all the needed imports during importAll(), sometimes we miss a module so ensure it gets loaded
+    auto im = mapper.AddImplicitImportForDecl(loc, ImportD, true);
+    im->isstatic = true;
+    auto dst = Package::resolve(im->packages, NULL, &im->pkg);
+    if (!dst->lookup(im->id))
+    {
+        im->semantic(sc);
+        im->semantic2(sc);
+    }
+
+    auto e = expmap.fromExpressionDeclRef(loc, const_cast<clang::NamedDecl*>(D),
+                                            nullptr, TQ_OverOpSkipSpecArg);
+    e = e->semantic(sc);
+
+    Dsymbol *s = nullptr;
+    if (e->op == TOKvar)
+        s = static_cast<SymbolExp*>(e)->var;
+    else if (e->op == TOKtemplate)
+        s = static_cast<TemplateExp*>(e)->td;
+    else if (e->op == TOKimport)
+        s = static_cast<ScopeExp*>(e)->sds;
+
+    // Memory usage can skyrocket when using a large library
+    if (im->packages) delete im->packages;
+    delete im;
+    delete e;
+
+    return s;
+}
+
+// The module of the traversed body has to load the module of D even when its own codegen gets reused and its
+// bodies skipped, see Module::importReferencedModules()
+void DeclReferencer::RecordReferencedModule(const clang::NamedDecl *D)
+{
+    if (!isCPP(sc->module))
+        return;
+
+    auto m = static_cast<cpp::Module*>(sc->module);
+    auto Key = mapper.GetImplicitImportKeyForDecl(D);
+    if (Key == m->rootKey || !m->referencedKeys.insert(Key).second)
+        return;
+
+    auto im = mapper.AddImplicitImportForDecl(loc, D, true);
+
+    std::string modName;
+    for (auto id: *im->packages)
+    {
+        modName += id->toChars();
+        modName += '.';
+    }
+    modName += im->id->toChars();
+    m->referencedModules.insert(modName);
+
+    if (im->packages) delete im->packages;
+    delete im;
 }
 
 bool DeclReferencer::Reference(const clang::NamedDecl *D)
@@ -238,20 +329,13 @@ bool DeclReferencer::Reference(const clang::NamedDecl *D)
                 // This may get fixed by 3.7.
     }
 
+    RecordReferencedModule(D); // before the check, other modules may have referenced D already
+
     if (Referenced.count(D->getCanonicalDecl()))
         return true;
     Referenced.insert(D->getCanonicalDecl());
 
-    // Although we try to add all the needed imports during importAll(), sometimes we miss a module so ensure it gets loaded
-    auto im = mapper.AddImplicitImportForDecl(loc, D, true);
-    im->isstatic = true;
-    auto dst = Package::resolve(im->packages, NULL, &im->pkg);
-    if (!dst->lookup(im->id))
-    {
-        im->semantic(sc);
-        im->semantic2(sc);
-    }
-
+    auto ImportD = D;
     ReferenceTemplateArguments(D);
 
     auto Func = dyn_cast<clang::FunctionDecl>(D);
@@ -270,23 +354,23 @@ bool DeclReferencer::Reference(const clang::NamedDecl *D)
             return true;
     }
 
-    auto e = expmap.fromExpressionDeclRef(loc, const_cast<clang::NamedDecl*>(D),
-                                            nullptr, TQ_OverOpSkipSpecArg);
-    e = e->semantic(sc);
+    // if it's a non-template function there's nothing to do, it will be semantic'd along with its declcontext
+    // if it's a template spec we must instantiate the right overload
+    auto mapped = getMappedSymbol(D);
+    bool isTemplateSpec = Func && Func->getPrimaryTemplate();
 
-    if (Func && Func->getPrimaryTemplate())
+    if (mapped && (!isTemplateSpec || mapped->isTemplateDeclaration()))
     {
-        assert(e->op == TOKvar || e->op == TOKtemplate || e->op == TOKimport);
-        Dsymbol *s;
-        if (e->op == TOKvar)
-            s = static_cast<SymbolExp*>(e)->var;
-        else if (e->op == TOKtemplate)
-            s = static_cast<TemplateExp*>(e)->td;
-        else
-            s = static_cast<ScopeExp*>(e)->sds;
-
-        // if it's a non-template function there's nothing to do, it will be semantic'd along with its declcontext
-        // if it's a template spec we must instantiate the right overload
+        if (!isTemplateSpec)
+            return true;
+    }
+    else
+    {
+        auto s = ReferenceThroughImport(D, ImportD);
+        if (!isTemplateSpec)
+            return true;
+        assert(s);
+
         struct DEquals
         {
             const clang::Decl* D;
@@ -315,34 +399,30 @@ bool DeclReferencer::Reference(const clang::NamedDecl *D)
         DEquals p;
         p.D = D;
         overloadApply(s, &p, &DEquals::fp);
-        assert(p.s && p.s->isTemplateDeclaration());
-
-        auto td = static_cast<cpp::TemplateDeclaration*>(p.s->isTemplateDeclaration());
-        if (td->semanticRun == PASSinit)
-        {
-            assert(td->scope);
-            td->semantic(td->scope); // this must be done here because havetempdecl being set to true it won't be done by findTempDecl()
-            assert(td->semanticRun > PASSinit);
-        }
+        mapped = p.s;
+    }
+    assert(mapped && mapped->isTemplateDeclaration());
 
-        auto tiargs = mapper.fromTemplateArguments(loc, Func->getTemplateSpecializationArgs());
-        assert(tiargs);
-        SpecValue spec(mapper);
-        getIdentifier(Func, &spec, true);
-        if (spec)
-            tiargs->shift(spec.toTemplateArg(loc));
-        auto tempinst = new cpp::TemplateInstance(loc, td, tiargs);
-        tempinst->Inst = const_cast<clang::FunctionDecl*>(Func);
-        tempinst->semantictiargsdone = false; // NOTE: the "havetempdecl" ctor of Templateinstance set semantictiargsdone to true...
-                                                            // Time was lost finding this out for the second or third time.
-        td->makeForeignInstance(tempinst);
-        tempinst->semantic(sc);
+    auto td = static_cast<cpp::TemplateDeclaration*>(mapped->isTemplateDeclaration());
+    if (td->semanticRun == PASSinit)
+    {
+        assert(td->scope);
+        td->semantic(td->scope); // this must be done here because havetempdecl being set to true it won't be done by findTempDecl()
+        assert(td->semanticRun > PASSinit);
     }
 
-    // Memory usage can skyrocket when using a large library
-    if (im->packages) delete im->packages;
-    delete im;
-    delete e;
+    auto tiargs = mapper.fromTemplateArguments(loc, Func->getTemplateSpecializationArgs());
+    assert(tiargs);
+    SpecValue spec(mapper);
+    getIdentifier(Func, &spec, true);
+    if (spec)
+        tiargs->shift(spec.toTemplateArg(loc));
+    auto tempinst = new cpp::TemplateInstance(loc, td, tiargs);
+    tempinst->Inst = const_cast<clang::FunctionDecl*>(Func);
+    tempinst->semantictiargsdone = false; // NOTE: the "havetempdecl" ctor of Templateinstance set semantictiargsdone to true...
+                                                        // Time was lost finding this out for the second or third time.
+    td->makeForeignInstance(tempinst);
+    tempinst->semantic(sc);
 
     return true;
 }
@@ -436,17 +516,21 @@ void FuncDeclaration::semantic3reference(::FuncDeclaration *fd, Scope *sc)
     if (!FD)
         return;
 
-    const clang::FunctionDecl *Def;
-    if (!FD->isInvalidDecl() && FD->hasBody(Def))
+    // What the functions of a module reused from a previous compilation reference was emitted in its object file as well
+    auto m = fd->getModule();
+    if (m && isCPP(m) && !fd->isInstantiated() &&
+            static_cast<Module*>(m)->isCodegenCached())
     {
-        auto globalSc = globalScope(sc->instantiatingModule());
-        declReferencer.Traverse(fd->loc, globalSc, Def->getBody());
-
-        if (auto Ctor = dyn_cast<clang::CXXConstructorDecl>(FD))
-            for (auto& Init: Ctor->inits())
-                declReferencer.Traverse(fd->loc, globalSc, Init->getInit());
+        static_cast<Module*>(m)->importReferencedModules();
+        fd->semanticRun = PASSsemantic3done;
+        return;
     }
 
+    instantiateFunctionDefinition(FD);
+
+    if (!FD->isInvalidDecl())
+        declReferencer.Traverse(fd->loc, globalScope(sc->instantiatingModule()), FD);
+
     fd->semanticRun = PASSsemantic3done;
 }
 
@@ -141,6 +141,8 @@ const clang::FunctionDecl *getFD(::FuncDeclaration *f);
 // NOTE: we use copy constructors only to copy the arguments passed to the main constructor, the rest is handled by syntaxCopy
 
 bool isMapped(const clang::Decl *D);
+Dsymbol *getMappedSymbol(const clang::Decl *D); // first function or template declaration DeclMapper created from D, or null
+void MarkFunctionForEmit(const clang::FunctionDecl *D);
 
 class DeclMapper : public TypeMapper
 {
@@ -194,6 +196,18 @@ class DeclReferencer : public clang::RecursiveASTVisitor<DeclReferencer>
 
     llvm::DenseSet<const clang::Decl *> Referenced;
 
+    struct WorkItem
+    {
+        Loc loc;
+        Scope *sc;
+        const clang::FunctionDecl *FD;
+    };
+    llvm::SmallVector<WorkItem, 32> Worklist; // functions whose body is waiting to be traversed
+    llvm::DenseSet<const clang::FunctionDecl *> Queued; // canonical decls
+    bool draining = false;
+
+    Dsymbol *ReferenceThroughImport(const clang::NamedDecl *D, const clang::NamedDecl *ImportD);
+    void RecordReferencedModule(const clang::NamedDecl *D);
     bool Reference(const clang::NamedDecl *D);
     bool Reference(const clang::Type *T);
     void ReferenceTemplateArguments(const clang::NamedDecl *D);
@@ -206,7 +220,7 @@ public:
         mapper.cppPrefix = false;
     }
 
-    void Traverse(Loc loc, Scope *sc, clang::Stmt *S);
+    void Traverse(Loc loc, Scope *sc, const clang::FunctionDecl *FD);
 
     bool VisitCXXConstructExpr(const clang::CXXConstructExpr *E);
     bool VisitCXXNewExpr(const clang::CXXNewExpr *E);
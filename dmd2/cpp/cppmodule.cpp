@@ -24,8 +24,14 @@
 
 #include <stdlib.h>
 #include <string>
+#include <chrono>
+#include <algorithm>
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/DeclCXX.h"
 #include "clang/AST/DeclTemplate.h"
@@ -97,6 +103,9 @@ Module::Module(const char* filename, Identifier* ident, Identifiers *packages)
 
 Dsymbol *Module::search(Loc loc, Identifier *ident, int flags)
 {
+    if (lazyDC)
+        mapLazily(ident);
+
     auto result = ::Module::search(loc, ident, flags);
 
     if ((flags & IgnorePrivateMembers) && result && result->isImport())
@@ -128,6 +137,34 @@ void Module::addPreambule()
     }
 }
 
+// The object of a lazily mapped module only holds what the current compilation looked up, so rather than the shared
+// object of the cache entry each output (executable, or object of the root module) gets its own
+static const std::string& lazyObjectDir()
+{
+    static std::string dir;
+    if (!dir.empty())
+        return dir;
+
+    const char *output = global.params.exefile ? global.params.exefile : global.params.objname;
+    if (!output && ::Module::rootModule)
+        output = ::Module::rootModule->srcfile->name->str;
+
+    llvm::SmallString<128> absOutput(output ? output : "");
+    llvm::sys::fs::make_absolute(absOutput);
+
+    llvm::MD5 Hash;
+    Hash.update(absOutput);
+    llvm::MD5::MD5Result Result;
+    Hash.final(Result);
+    llvm::SmallString<32> HashStr;
+    llvm::MD5::stringifyResult(Result, HashStr);
+
+    llvm::SmallString<128> lazyDir(calypso.pch.entryDir);
+    llvm::sys::path::append(lazyDir, llvm::Twine("lazy-") + HashStr);
+    dir = lazyDir.str().str();
+    return dir;
+}
+
 File *Module::buildFilePath(const char *, const char *path, const char *ext)
 {
     const char *argobj;
@@ -136,8 +173,8 @@ File *Module::buildFilePath(const char *, const char *path, const char *ext)
     else
         argobj = FileName::name(this->arg);
 
-    if (!opts::cppCacheDir.empty())
-        path = opts::cppCacheDir.c_str();
+    // Object files belong to the cache entry of the current header set, like the .gen list tracking them
+    path = lazyDC ? lazyObjectDir().c_str() : calypso.pch.entryDir.c_str();
 
     assert(!FileName::absolute(argobj));
     argobj = FileName::combine(path, argobj);
@@ -148,6 +185,71 @@ File *Module::buildFilePath(const char *, const char *path, const char *ext)
     return new File(FileName::forceExt(argobj, ext));
 }
 
+// The object filename is only set by buildTargetFiles() once semantic3 is over, so the path is worked out here the same way
+bool Module::isCodegenCached()
+{
+    if (codegenCached != -1)
+        return codegenCached;
+
+    const char *ext = nullptr;
+    if (global.params.output_o)
+        ext = global.params.targetTriple.isOSWindows() ? global.obj_ext_alt : global.obj_ext;
+    else if (global.params.output_bc)
+        ext = global.bc_ext;
+    else if (global.params.output_ll)
+        ext = global.ll_ext;
+    else if (global.params.output_s)
+        ext = global.s_ext;
+
+    codegenCached = false;
+    if (global.params.obj && !global.params.singleObj && ext && !lazyDC) // lazy modules are never reused
+    {
+        calypso.genModSet.parse();
+        auto Gen = calypso.genModSet.find(objfile ? objfile->name->str :
+                                    buildFilePath(nullptr, global.params.objdir, ext)->name->str);
+        if (Gen != calypso.genModSet.end())
+        {
+            codegenCached = true;
+            cachedReferences = Gen->getValue();
+        }
+    }
+
+    return codegenCached;
+}
+
+// The modules referenced by the skipped bodies would otherwise be neither loaded nor linked
+void Module::importReferencedModules()
+{
+    if (cachedReferences.empty())
+        return;
+
+    auto sc = globalScope(this);
+
+    llvm::SmallVector<llvm::StringRef, 16> modNames;
+    llvm::StringRef(cachedReferences).split(modNames, ' ', -1, false);
+
+    for (auto modName: modNames)
+    {
+        llvm::SmallVector<llvm::StringRef, 4> idents;
+        modName.split(idents, '.');
+
+        auto packages = new Identifiers;
+        for (unsigned i = 0; i + 1 < idents.size(); i++)
+            packages->push(Identifier::idPool(idents[i].data(), idents[i].size()));
+
+        auto im = new cpp::Import(loc, packages, Identifier::idPool(idents.back().data(), idents.back().size()),
+                                  nullptr, 1);
+        auto dst = Package::resolve(im->packages, NULL, &im->pkg);
+        if (!dst->lookup(im->id))
+        {
+            im->semantic(sc);
+            im->semantic2(sc);
+        }
+    }
+
+    cachedReferences.clear(); // once per module
+}
+
 /************************************/
 
 // DeclMapper::DeclMapper(Module* mod)
@@ -199,6 +301,29 @@ Dsymbols *DeclMapper::VisitDeclContext(const clang::DeclContext *DC)
     return decldefs;
 }
 
+// Functions and template declarations are indexed by canonical decl, so that the symbol of a referenced decl doesn't
+// have to be searched through its whole overload set
+static void indexMappedSymbol(Dsymbol *s)
+{
+    if (!isCPP(s))
+        return;
+
+    const clang::Decl *D = nullptr;
+    if (auto fd = s->isFuncDeclaration())
+        D = getFD(fd);
+    else if (auto td = s->isTemplateDeclaration())
+        D = static_cast<TemplateDeclaration*>(td)->TempOrSpec;
+
+    if (D)
+        calypso.MappedSymbols.insert(std::make_pair(getCanonicalDecl(D), s));
+}
+
+Dsymbol *getMappedSymbol(const clang::Decl *D)
+{
+    auto Found = calypso.MappedSymbols.find(getCanonicalDecl(D));
+    return Found != calypso.MappedSymbols.end() ? Found->second : nullptr;
+}
+
 Dsymbols *DeclMapper::VisitDecl(const clang::Decl *D, unsigned flags)
 {
     if (D != getCanonicalDecl(D))
@@ -242,6 +367,10 @@ Dsymbols *DeclMapper::VisitDecl(const clang::Decl *D, unsigned flags)
 #undef DECL
 #undef DECLWF
 
+    if (s)
+        for (auto sym: *s)
+            indexMappedSymbol(sym);
+
     return s;
 }
 
@@ -343,7 +472,7 @@ Dsymbols *DeclMapper::VisitValueDecl(const clang::ValueDecl *D)
     return decldefs;
 }
 
-static void MarkFunctionForEmit(const clang::FunctionDecl *D)
+void MarkFunctionForEmit(const clang::FunctionDecl *D)
 {
     auto& S = calypso.getSema();
     auto& Diags = calypso.getDiagnostics();
@@ -402,6 +531,7 @@ Dsymbols *DeclMapper::VisitRecordDecl(const clang::RecordDecl *D, unsigned flags
         D = D->getDefinition();
     bool isDefined = D->isCompleteDefinition();
     bool isStruct = !isPolymorphic(D) && !(flags & ForcePolymorphic);
+    bool isLazy = hasLazyMembers(D);
 
     auto TND = D->getTypedefNameForAnonDecl();
 
@@ -491,17 +621,22 @@ Dsymbols *DeclMapper::VisitRecordDecl(const clang::RecordDecl *D, unsigned flags
             // Clang declares and defines implicit ctors/assignment operators lazily,
             // but they need to be emitted all in the record module.
             // Mark them for emit here since they won't be visited.
-            MarkEmit(S.LookupDefaultConstructor(_CRD));
-            for (int i = 0; i < 2; i++)
-                MarkEmit(S.LookupCopyingConstructor(_CRD, i ? clang::Qualifiers::Const : 0));
+            // With lazy members the ctors and assignment operators get declared by mapLazyMembers instead.
+            if (!isLazy)
+            {
+                MarkEmit(S.LookupDefaultConstructor(_CRD));
+                for (int i = 0; i < 2; i++)
+                    MarkEmit(S.LookupCopyingConstructor(_CRD, i ? clang::Qualifiers::Const : 0));
+            }
             
             MarkEmit(S.LookupDestructor(_CRD));
 
-            for (int i = 0; i < 2; i++)
-                for (int j = 0; j < 2; j++)
-                    for (int k = 0; k < 2; k++)
-                        MarkEmit(S.LookupCopyingAssignment(_CRD, i ? clang::Qualifiers::Const : 0, j ? true : false,
-                                                  k ? clang::Qualifiers::Const : 0));
+            if (!isLazy)
+                for (int i = 0; i < 2; i++)
+                    for (int j = 0; j < 2; j++)
+                        for (int k = 0; k < 2; k++)
+                            MarkEmit(S.LookupCopyingAssignment(_CRD, i ? clang::Qualifiers::Const : 0, j ? true : false,
+                                                      k ? clang::Qualifiers::Const : 0));
         }
     }
 
@@ -526,6 +661,9 @@ Dsymbols *DeclMapper::VisitRecordDecl(const clang::RecordDecl *D, unsigned flags
               !isa<clang::RedeclarableTemplateDecl>(M) && !isa<clang::TypedefNameDecl>(M))
             continue;
 
+        if (isLazy && isLazyRecordMember(M))
+            continue;  // mapped on first search, see mapLazyMembers
+
         if (auto s = VisitDecl(M))
             members->append(s);
     }
@@ -1447,9 +1585,8 @@ static inline bool isTopLevelInNamespaceModule (const clang::Decl *D)
     return true;
 }
 
-static void mapNamespace(DeclMapper &mapper,
-                             const clang::DeclContext *DC,
-                             Dsymbols *members,
+static void collectNamespace(const clang::DeclContext *DC,
+                             PCH::ModuleDeclsTy &Decls,
                              bool forClangModule = false)
 {
     auto CanonDC = cast<clang::Decl>(DC)->getCanonicalDecl();
@@ -1476,49 +1613,43 @@ static void mapNamespace(DeclMapper &mapper,
         auto InnerNS = dyn_cast<clang::NamespaceDecl>(*D);
         if ((InnerNS && InnerNS->isInline()) || isa<clang::LinkageSpecDecl>(*D))
         {
-            mapNamespace(mapper, cast<clang::DeclContext>(*D), members, forClangModule);
+            collectNamespace(cast<clang::DeclContext>(*D), Decls, forClangModule);
             continue;
         }
         else if (!isTopLevelInNamespaceModule(*D))
             continue;
 
-        if (auto s = mapper.VisitDecl(*D))
-            members->append(s);
+        Decls.emplace_back(*D, 0);
     }
 }
 
-static void mapClangModule(DeclMapper &mapper,
-                             const clang::Decl *Root,
+// Looks for the declarations of the Clang module M inside the namespace Root (which may be the global one)
+static void collectClangModule(const clang::Decl *Root,
                              clang::Module *M,
-                             Dsymbols *members)
+                             PCH::ModuleDeclsTy &Decls)
 {
     auto AST = calypso.getASTUnit();
     auto& SrcMgr = calypso.getSourceManager();
 
     llvm::SmallVector<clang::Decl*, 32> RegionDecls;
 
-    // HACK-ish but Clang doesn't offer a straightforward way
-    // SourceManager::translateFile() only offers the first FID of a FileEntry which doesn't contain all the decls,
-    // so we need to loop over all the FID corresponding to Header.Entry.
-    auto findRegionDecls = [&] (const clang::SrcMgr::SLocEntry& SLoc) {
-        if (SLoc.isFile() && SLoc.getFile().getContentCache())
-        {
-            for (auto& Header: M->Headers[clang::Module::HK_Normal])
-            {
-                if (SLoc.getFile().getContentCache()->OrigEntry != Header.Entry)
-                    continue;
+    llvm::SmallVector<clang::FileID, 16> FIDs;
+    for (auto& Header: M->Headers[clang::Module::HK_Normal])
+    {
+        auto& HeaderFIDs = calypso.pch.getFileIDs(Header.Entry);
+        FIDs.append(HeaderFIDs.begin(), HeaderFIDs.end());
+    }
 
-                auto Loc = clang::SourceLocation::getFromRawEncoding(SLoc.getOffset());
-                auto FID = SrcMgr.getFileID(Loc); // NOTE: getting a FileID without a SourceLocation is impossible, it's locked tight
-                AST->findFileRegionDecls(FID, 0, SrcMgr.getFileIDSize(FID), RegionDecls); // passed Length is the maximum value before offset overflow kicks in
-            }
-        }
-    };
+    // Keep the SLoc entry order, i.e local FileIDs first in increasing order then loaded ones, which are negative and decreasing
+    std::sort(FIDs.begin(), FIDs.end(), [] (clang::FileID a, clang::FileID b) {
+        int A = a.getHashValue(), B = b.getHashValue();
+        if ((A < 0) != (B < 0))
+            return A > 0;
+        return A < 0 ? A > B : A < B;
+    });
 
-    for (unsigned I = 0, N = SrcMgr.local_sloc_entry_size(); I != N; ++I)
-        findRegionDecls(SrcMgr.getLocalSLocEntry(I));
-    for (unsigned I = 0, N = SrcMgr.loaded_sloc_entry_size(); I != N; ++I)
-        findRegionDecls(SrcMgr.getLoadedSLocEntry(I));
+    for (auto FID: FIDs)
+        AST->findFileRegionDecls(FID, 0, SrcMgr.getFileIDSize(FID), RegionDecls); // passed Length is the maximum value before offset overflow kicks in
 
     // Not forgetting namespace redecls
     llvm::SmallVector<clang::Decl*, 8> RootDecls, ParentDecls;
@@ -1558,12 +1689,12 @@ static void mapClangModule(DeclMapper &mapper,
         fatal();
     }
 
-    std::function<void(const clang::Decl *)> Map = [&] (const clang::Decl *D)
+    std::function<void(const clang::Decl *)> Collect = [&] (const clang::Decl *D)
     {
         if (auto LinkSpec = dyn_cast<clang::LinkageSpecDecl>(D))
         {
             for (auto LD: LinkSpec->decls())
-                Map(LD);
+                Collect(LD);
             return;
         }
 
@@ -1575,33 +1706,180 @@ static void mapClangModule(DeclMapper &mapper,
         if (!isTopLevelInNamespaceModule(D))
             return;
 
-        if (auto s = mapper.VisitDecl(D))
-            members->append(s);
+        Decls.emplace_back(D, 0);
     };
 
     if (!isa<clang::TranslationUnitDecl>(Root))
         for (auto R: RootDecls)
-            mapNamespace(mapper, cast<clang::DeclContext>(R), members, true);
+            collectNamespace(cast<clang::DeclContext>(R), Decls, true);
     else
+        for (auto D: RegionDecls)
+            if (isa<clang::TranslationUnitDecl>(D->getDeclContext()))
+                Collect(D);
+}
+
+// Map the macros contained in the module headers (currently limited to numerical constants)
+static void mapClangModuleMacros(DeclMapper &mapper,
+                             clang::Module *M,
+                             Dsymbols *members)
+{
+    for (auto& Header: M->Headers[clang::Module::HK_Normal])
     {
-        // Map the macros contained in the module headers (currently limited to numerical constants)
-        for (auto& Header: M->Headers[clang::Module::HK_Normal])
-        {
-            auto MacroMapEntry = calypso.MacroMap[&Header];
-            if (!MacroMapEntry)
-                continue;
+        auto MacroMapEntry = calypso.getMacroMapEntry(&Header);
+        if (!MacroMapEntry)
+            continue;
 
-            for (auto& P: *MacroMapEntry)
-                if (auto s = mapper.VisitMacro(P.first, P.second))
-                    members->push(s);
-        }
+        for (auto& P: *MacroMapEntry)
+            if (auto s = mapper.VisitMacro(P.first, P.second))
+                members->push(s);
+    }
+}
 
-        for (auto D: RegionDecls)
-            if (isa<clang::TranslationUnitDecl>(D->getDeclContext()))
-                Map(D);
+// The declarations of a module are looked up once per PCH file, the next compilations get them from the cache
+template<typename CollectFn>
+static void getModuleDecls(const std::string &name, PCH::ModuleDeclsTy &Decls, CollectFn Collect)
+{
+    double lookupTime;
+    if (calypso.pch.loadModuleDecls(name, Decls, lookupTime))
+    {
+        calypso.stats.cachedModuleImports++;
+        calypso.stats.moduleLookupTimeSaved += lookupTime;
+
+        if (opts::cppStats)
+            fprintf(global.stdmsg, "cpp-stats import %s: %u declarations from the cache, %.3fms saved\n",
+                    name.c_str(), (unsigned) Decls.size(), lookupTime * 1000);
+        return;
+    }
+
+    auto lookupStart = std::chrono::steady_clock::now();
+    Collect();
+
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - lookupStart;
+    calypso.pch.saveModuleDecls(name, Decls, time.count());
+}
+
+void addLateMembers(ScopeDsymbol *sds, Scope *sc, Dsymbols *syms, PASS pass)
+{
+    for (auto s: *syms)
+        s->addMember(sc, sds);
+    for (auto s: *syms)
+    {
+        s->setScope(sc);
+        s->importAll(sc);
+    }
+
+    for (auto s: *syms)
+    {
+        if (pass >= PASSsemantic)
+            s->semantic(sc);
+        if (pass >= PASSsemantic2)
+            s->semantic2(sc);
+        if (pass >= PASSsemantic3)
+            s->semantic3(sc);
+    }
+}
+
+void Module::processLateImports()
+{
+    while (lateImports.dim)
+    {
+        Dsymbols imports; // importing may map more declarations and add more imports
+        imports.append(&lateImports);
+        lateImports.setDim(0);
+
+        Scope *sc = Scope::createGlobal(this);
+        addLateMembers(this, sc, &imports, semanticRun);
+        sc = sc->pop();
+        sc->pop();
+    }
+}
+
+// Same filters as collectNamespace, for a declaration found by lookup in lazyDC
+void Module::addLazyMember(const clang::Decl *D)
+{
+    auto MMap = calypso.pch.MMap;
+    auto& SrcMgr = calypso.getSourceManager();
+
+    // Enumerators of anonymous enums are visible from the namespace, the enum is what gets mapped
+    if (isa<clang::EnumConstantDecl>(D))
+        D = cast<clang::Decl>(D->getDeclContext());
+
+    auto DC = D->getDeclContext();
+    while (DC->isInlineNamespace() || isa<clang::LinkageSpecDecl>(DC))
+        DC = DC->getParent();
+    if (cast<clang::Decl>(DC)->getCanonicalDecl() != cast<clang::Decl>(lazyDC)->getCanonicalDecl())
+        return;  // only map declarations that are semantically within the namespace
+
+    if (!isTopLevelInNamespaceModule(D))
+        return;
+
+    D = getCanonicalDecl(D);
+    if (!lazyDecls.insert(D).second)
+        return;
+
+    auto DLoc = SrcMgr.getFileLoc(D->getLocation());
+#ifdef USE_CLANG_MODULES
+    if (DLoc.isValid() && DLoc.isFileID()
+            && MMap->findModuleForHeader(
+                SrcMgr.getFileEntryForID(SrcMgr.getFileID(DLoc))))
+        return;  // skip decls which are parts of a Clang module
+#endif
+
+    DeclMapper mapper(this);
+    auto s = mapper.VisitDecl(D);
+    if (!s)
+        return;
+
+    members->append(s);
+    if (!symtab)
+        return; // importAll() hasn't run yet and will add them
+
+    processLateImports();
+
+    Scope *sc = Scope::createGlobal(this);
+    addLateMembers(this, sc, s, semanticRun);
+    sc = sc->pop();
+    sc->pop();
+}
+
+void Module::mapLazily(Identifier *ident)
+{
+    if (!lazyIdents.insert(ident).second)
+        return;
+
+    for (auto D: lookup(lazyDC, ident))
+        addLazyMember(D);
+}
+
+static void completeNamespace(const clang::DeclContext *DC,
+                              llvm::function_ref<void(const clang::Decl*)> add)
+{
+    for (auto D: DC->decls())
+    {
+        auto InnerNS = dyn_cast<clang::NamespaceDecl>(D);
+        if ((InnerNS && InnerNS->isInline()) || isa<clang::LinkageSpecDecl>(D))
+            completeNamespace(cast<clang::DeclContext>(D), add);
+        else
+            add(D);
     }
 }
 
+void Module::completeMembers()
+{
+    if (!lazyDC)
+        return;
+
+    auto add = [&] (const clang::Decl *D) { addLazyMember(D); };
+
+    if (auto NS = dyn_cast<clang::NamespaceDecl>(lazyDC))
+        for (auto Redecl: NS->redecls())
+            completeNamespace(Redecl, add);
+    else
+        completeNamespace(lazyDC, add);
+
+    lazyDC = nullptr;
+}
+
 Module *Module::load(Loc loc, Identifiers *packages, Identifier *id)
 {
     auto& Context = calypso.getASTContext();
@@ -1653,7 +1931,8 @@ Module *Module::load(Loc loc, Identifiers *packages, Identifier *id)
     if (!M)
         M = tryFindClangModule(loc, packages, id, pkg, packages->dim);
 
-    auto m = new Module(moduleName(packages, id).c_str(),
+    auto name = moduleName(packages, id);
+    auto m = new Module(name.c_str(),
                         id, packages);
     m->members = new Dsymbols;
     m->parent = pkg;
@@ -1666,98 +1945,108 @@ Module *Module::load(Loc loc, Identifiers *packages, Identifier *id)
         auto D = cast<clang::Decl>(DC)->getCanonicalDecl();
         m->rootKey.first = D;
         m->rootKey.second = M;
-        mapClangModule(mapper, D, M, m->members);
+
+        auto mapStart = std::chrono::steady_clock::now();
+
+        PCH::ModuleDeclsTy Decls;
+        getModuleDecls(name, Decls, [&] { collectClangModule(D, M, Decls); });
+
+        if (isa<clang::TranslationUnitDecl>(D))
+            mapClangModuleMacros(mapper, M, m->members);
+
+        for (auto& P: Decls)
+            if (auto s = mapper.VisitDecl(P.first))
+                m->members->append(s);
+
+        std::chrono::duration<double> mapTime = std::chrono::steady_clock::now() - mapStart;
+        calypso.stats.clangModuleImports++;
+        calypso.stats.clangModuleMapTime += mapTime.count();
     }
     else if (strcmp(id->string, "_") == 0)  // Hardcoded module with all the top-level non-tag decls + the anonymous tags of a namespace which aren't in a Clang module
     {
         m->rootKey.first = cast<clang::Decl>(DC)->getCanonicalDecl();
 
-        auto NS = dyn_cast<clang::NamespaceDecl>(DC);
-        if (!NS)
-        {
-            assert(isa<clang::TranslationUnitDecl>(DC));
-
-            mapNamespace(mapper, DC, m->members);
-        }
-        else
-        {
-            auto I = NS->redecls_begin(),
-                    E = NS->redecls_end();
-
-            for (; I != E; ++I)
-            {
-                DC = *I;
-                mapNamespace(mapper, DC, m->members);
-            }
-        }
+        // Namespaces such as std or the global one have thousands of declarations, so they get mapped by search()
+        // whenever a name gets looked up. Only __traits(allMembers) needs them all (see completeMembers).
+        assert(isa<clang::TranslationUnitDecl>(DC) || isa<clang::NamespaceDecl>(DC));
+        m->lazyDC = DC;
     }
     else
     {
-        clang::NamedDecl *D = nullptr;
+        PCH::ModuleDeclsTy Decls;
+        getModuleDecls(name, Decls, [&] {
+            clang::NamedDecl *D = nullptr;
 
-        // Lookups can't find the implicit __va_list_tag record
-        if (id == Identifier::idPool("__va_list_tag") && packages->dim == 1)
-        {
-            D = cast<clang::NamedDecl>(Context.getVaListTagDecl());
-        }
-        else
-        {
-            auto R = lookup(DC, id);
-            if (R.empty())
+            // Lookups can't find the implicit __va_list_tag record
+            if (id == Identifier::idPool("__va_list_tag") && packages->dim == 1)
             {
-                ::error(loc, "no C++ module named %s", id->toChars());
-                fatal();
+                D = cast<clang::NamedDecl>(Context.getVaListTagDecl());
             }
-
-            // Module must be a record or enum
-            for (auto Match: R)
+            else
             {
-                if (auto Typedef = dyn_cast<clang::TypedefNameDecl>(Match))
-                    if (auto Tag = isAnonTagTypedef(Typedef))
-                        Match = const_cast<clang::TagDecl*>(Tag);
-
-                if (isa<clang::TagDecl>(Match) || isa<clang::ClassTemplateDecl>(Match))
-                    D = Match;
-            }
+                auto R = lookup(DC, id);
+                if (R.empty())
+                {
+                    ::error(loc, "no C++ module named %s", id->toChars());
+                    fatal();
+                }
 
-            if (!D)
-            {
-                ::error(loc, "C++ modules have to be records (class/struct, template or not) or enums");
-                fatal();
-            }
-        }
+                // Module must be a record or enum
+                for (auto Match: R)
+                {
+                    if (auto Typedef = dyn_cast<clang::TypedefNameDecl>(Match))
+                        if (auto Tag = isAnonTagTypedef(Typedef))
+                            Match = const_cast<clang::TagDecl*>(Tag);
 
-        if (auto Spec = dyn_cast<clang::ClassTemplateSpecializationDecl>(D))
-            D = Spec->getSpecializedTemplate();
+                    if (isa<clang::TagDecl>(Match) || isa<clang::ClassTemplateDecl>(Match))
+                        D = Match;
+                }
 
-        D = cast<clang::NamedDecl>(D->getCanonicalDecl());
-        auto CTD = dyn_cast<clang::ClassTemplateDecl>(D);
+                if (!D)
+                {
+                    ::error(loc, "C++ modules have to be records (class/struct, template or not) or enums");
+                    fatal();
+                }
+            }
 
-        if (CTD)
-            m->rootKey.first = CTD->getTemplatedDecl();
-        else
-            m->rootKey.first = D;
+            if (auto Spec = dyn_cast<clang::ClassTemplateSpecializationDecl>(D))
+                D = Spec->getSpecializedTemplate();
 
-        if (auto s = mapper.VisitDecl(D, DeclMapper::MapImplicitRecords))
-            m->members->append(s);
+            D = cast<clang::NamedDecl>(D->getCanonicalDecl());
+            Decls.emplace_back(D, DeclMapper::MapImplicitRecords);
 
-        // Add the non-member overloaded operators that are meant to work with this record/enum
-        for (int Op = 1; Op < clang::NUM_OVERLOADED_OPERATORS; Op++)
-        {
-            auto OpName = Context.DeclarationNames.getCXXOperatorName(
-                        static_cast<clang::OverloadedOperatorKind>(Op));
+            // Add the non-member overloaded operators that are meant to work with this record/enum
+            auto CTD = dyn_cast<clang::ClassTemplateDecl>(D);
+            auto Tag = CTD ? CTD->getTemplatedDecl() : cast<clang::TagDecl>(D);
+            LangPlugin::TagOperatorsTy TagOperators;
 
             for (auto Ctx = D->getDeclContext(); Ctx; Ctx = Ctx->getLookupParent())
             {
                 if (Ctx->isTransparentContext())
                     continue;
 
-                for (auto OverOp: Ctx->lookup(OpName))
-                    if (isOverloadedOperatorWithTagOperand(OverOp, D))
-                        if (auto s = mapper.VisitDecl(getCanonicalDecl(OverOp)))
-                            m->members->append(s);
+                if (auto CtxOperators = calypso.getTagOperators(Ctx, Tag))
+                    TagOperators.append(CtxOperators->begin(), CtxOperators->end());
             }
-        }
+
+            std::stable_sort(TagOperators.begin(), TagOperators.end(),
+                    [] (const std::pair<int, const clang::NamedDecl*> &a,
+                        const std::pair<int, const clang::NamedDecl*> &b) { return a.first < b.first; });
+
+            for (auto& OverOp: TagOperators)
+                Decls.emplace_back(getCanonicalDecl(OverOp.second), 0);
+        });
+
+        // The record or enum comes first
+        auto D = Decls[0].first;
+        if (auto CTD = dyn_cast<clang::ClassTemplateDecl>(D))
+            m->rootKey.first = CTD->getTemplatedDecl();
+        else
+            m->rootKey.first = D;
+
+        for (auto& P: Decls)
+            if (auto s = mapper.VisitDecl(P.first, P.second))
+                m->members->append(s);
 
 //         srcFilename = AST->getSourceManager().getFilename(TD->getLocation());
     }
@@ -12,9 +12,14 @@
 #include "module.h"
 #include "cpp/calypso.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringSet.h"
+
 namespace clang
 {
 class Decl;
+class DeclContext;
 }
 
 namespace cpp {
@@ -27,6 +32,14 @@ public:
     typedef std::pair<const clang::Decl *, const clang::Module *> RootKey;
     RootKey rootKey;
 
+    llvm::SmallDenseMap<RootKey, ::Import*, 8> implicitImports;
+    Dsymbols lateImports; // implicit imports added after importAll()
+
+    // Namespace "_" modules map their members on demand, when their name gets searched
+    const clang::DeclContext *lazyDC = nullptr;
+    llvm::DenseSet<Identifier *> lazyIdents; // names already looked up in lazyDC
+    llvm::DenseSet<const clang::Decl *> lazyDecls; // canonical decls already mapped
+
     static Package *rootPackage;    // package to store all C++ packages/modules, avoids name clashes (e.g std)
     static Modules amodules;            // array of all modules
     static void init();
@@ -35,13 +48,32 @@ public:
 
     static Module *load(Loc loc, Identifiers *packages, Identifier *ident);
     Dsymbol *search(Loc loc, Identifier *ident, int flags = IgnoreNone) override;
+    void completeMembers() override;
     void addPreambule() override;
     const char *manglePrefix() override { return "_Cpp"; }
     bool isCodegen() override { return true; }
 
     File* buildFilePath(const char* forcename, const char* path, const char* ext) override;
+    bool isCodegenCached(); // true if the object file of a previous compilation will be reused, see LangPlugin::needsCodegen()
+
+    // Modules referenced by the function bodies, recorded in the .gen list since the bodies of cached modules aren't walked
+    llvm::DenseSet<RootKey> referencedKeys;
+    llvm::StringSet<> referencedModules;
+    void importReferencedModules();
+
+    void processLateImports();
+
+protected:
+    int codegenCached = -1;
+    std::string cachedReferences; // from the .gen list, see importReferencedModules()
+
+    void mapLazily(Identifier *ident);
+    void addLazyMember(const clang::Decl *D);
 };
 
+// Runs the passes the parent already went through on symbols added to its members after importAll()
+void addLateMembers(ScopeDsymbol *sds, Scope *sc, Dsymbols *syms, PASS pass);
+
 }
 
 #endif /* DMD_CPP_CPPMODULE_H */
@@ -222,25 +222,92 @@ clang::FunctionDecl *instantiateFunctionDeclaration(clang::TemplateArgumentListI
 {
     auto& S = calypso.getSema();
 
+    // Most of the candidates DMD tries are expected to fail, so substitute the arguments the way template argument deduction does,
+    // i.e in a SFINAE context where substitution failures are recorded without building and emitting diagnostics
+    clang::Sema::SFINAETrap Trap(S);
+
     // Converts TemplateArgumentListInfo to something suitable for TemplateArgumentList
+    // Sema only treats errors as substitution failures inside an instantiation context, so one is pushed for the check
+    // of the arguments the way Sema::SubstituteExplicitTemplateArguments does
     llvm::SmallVector<clang::TemplateArgument, 4> Converted;
-    if (S.CheckTemplateArgumentList(FuncTemp, FuncTemp->getLocation(), Args,
-                                    false, Converted))
-        assert(false && "CheckTemplateArgumentList failed for function template");
+    {
+        clang::sema::TemplateDeductionInfo Info(FuncTemp->getLocation());
+        clang::Sema::InstantiatingTemplate Instantiating(S,
+                        FuncTemp->getLocation(), FuncTemp, llvm::ArrayRef<clang::TemplateArgument>(),
+                        clang::Sema::ActiveTemplateInstantiation::ExplicitTemplateArgumentSubstitution, Info);
+        if (Instantiating.isInvalid())
+            return nullptr; // e.g the instantiation depth limit was hit
+
+        if (S.CheckTemplateArgumentList(FuncTemp, FuncTemp->getLocation(), Args,
+                                        false, Converted))
+            return nullptr;
+    }
 
     clang::TemplateArgumentList ArgList(clang::TemplateArgumentList::OnStack,
                             Converted.data(), Converted.size());
     clang::MultiLevelTemplateArgumentList MultiList(ArgList);
 
     // Instantiate the declaration
+    clang::sema::TemplateDeductionInfo Info(FuncTemp->getLocation());
     clang::Sema::InstantiatingTemplate Instantiating(S,
-                    FuncTemp->getLocation(), FuncTemp->getTemplatedDecl());
+                    FuncTemp->getLocation(), FuncTemp, Converted,
+                    clang::Sema::ActiveTemplateInstantiation::DeducedTemplateArgumentSubstitution, Info);
     if (Instantiating.isInvalid())
-        assert(false && "InstantiatingTemplate is invalid");
+        return nullptr;
 
-    return llvm::cast_or_null<clang::FunctionDecl>(
+    auto FuncInst = llvm::cast_or_null<clang::FunctionDecl>(
                     S.SubstDecl(FuncTemp->getTemplatedDecl(),
                                 FuncTemp->getDeclContext(), MultiList));
+    if (Trap.hasErrorOccurred())
+        return nullptr;
+
+    return FuncInst;
+}
+
+// Key of LangPlugin::TemplateInsts
+static void profileTemplateInst(llvm::FoldingSetNodeID &ID, const clang::RedeclarableTemplateDecl *Temp,
+                                const clang::TemplateArgumentListInfo& Args)
+{
+    auto& Context = calypso.getASTContext();
+
+    ID.AddPointer(Temp->getCanonicalDecl());
+    for (unsigned i = 0; i < Args.size(); i++)
+        Context.getCanonicalTemplateArgument(Args[i].getArgument()).Profile(ID, Context);
+}
+
+static LangPlugin::TemplateInstEntry *findTemplateInst(const llvm::FoldingSetNodeID &ID)
+{
+    void *InsertPos;
+    return calypso.TemplateInsts.FindNodeOrInsertPos(ID, InsertPos);
+}
+
+static clang::NamedDecl *memoizeTemplateInst(const llvm::FoldingSetNodeID &ID, clang::NamedDecl *Inst)
+{
+    // Sema may have inserted other instances since findTemplateInst(), so the insert position has to be looked up again
+    void *InsertPos;
+    if (auto Entry = calypso.TemplateInsts.FindNodeOrInsertPos(ID, InsertPos))
+        Entry->Inst = Inst;
+    else
+    {
+        auto Key = ID.Intern(calypso.TemplateInstsAlloc);
+        calypso.TemplateInsts.InsertNode(new (calypso.TemplateInstsAlloc) LangPlugin::TemplateInstEntry(Key, Inst), InsertPos);
+    }
+    return Inst;
+}
+
+// The definitions of function template instances are only needed for codegen and for the references made by their body,
+// instantiating them right away would be wasted on the instances attempted during overload resolution
+void instantiateFunctionDefinition(const clang::FunctionDecl *D)
+{
+    auto& S = calypso.getSema();
+    auto& Diags = calypso.getDiagnostics();
+
+    if (D->isDefined() || D->isInvalidDecl() || !D->isImplicitlyInstantiable())
+        return;
+
+    S.InstantiateFunctionDefinition(D->getLocation(), const_cast<clang::FunctionDecl*>(D), true);
+    if (Diags.hasErrorOccurred())
+        Diags.Reset();
 }
 
 // Hijack the end of findTempDecl to only check forward refs for the unique candidate selected by Sema,
@@ -268,11 +335,28 @@ bool TemplateDeclaration::evaluateConstraint(::TemplateInstance* ti, Scope* sc,
         clang::TemplateArgumentListInfo Args;
         fillTemplateArgumentListInfo(ti->loc, sc, Args, dedtypes, Temp, tymap, expmap);
 
-        if (!instantiateFunctionDeclaration(Args, cast<clang::FunctionTemplateDecl>(FuncTemp)))
+        llvm::FoldingSetNodeID Key;
+        profileTemplateInst(Key, Temp, Args);
+        if (auto FoundInst = findTemplateInst(Key))
+        {
+            calypso.stats.templateInstHits++;
+            return FoundInst->Inst != nullptr;
+        }
+
+        calypso.stats.templateInstMisses++;
+
+        // Deduce the return type here as well, so that getClangTemplateInst() may return the memoized instance as is
+        auto FuncInst = instantiateFunctionDeclaration(Args, cast<clang::FunctionTemplateDecl>(FuncTemp));
+        if (!FuncInst || (FuncInst->getReturnType()->isUndeducedType() &&
+                calypso.getSema().DeduceReturnType(FuncInst, Temp->getLocation(), false)))
         {
             Diags.Reset();
+            memoizeTemplateInst(Key, nullptr); // don't try these arguments again
+            calypso.stats.templateInstFailures++;
             return false;
         }
+
+        memoizeTemplateInst(Key, FuncInst);
     }
     return true;
 }
@@ -387,6 +471,12 @@ MATCH TemplateDeclaration::matchWithInstance(Scope *sc, ::TemplateInstance *ti,
     else
     {
         auto Inst = getClangTemplateInst(sc, ti, tdtypes);
+        if (!Inst) // e.g the return type couldn't be deduced
+        {
+            delete tdtypes;
+            return MATCHnomatch;
+        }
+
         auto InstArgs = (isForeignInstance(ti) ? getTemplateInstantiationArgs(Inst) : getTemplateArgs(Inst))->asArray();
 
         if (tdtypes)
@@ -471,10 +561,33 @@ clang::RedeclarableTemplateDecl *TemplateDeclaration::getPrimaryTemplate()
     llvm_unreachable("Unhandled primary template");
 }
 
+static ::TemplateDeclaration *overloadRoot(::TemplateDeclaration *td)
+{
+    return td->overroot ? td->overroot : td;
+}
+
+// Looks up the template declaration mapped from D in the index, which is only a valid answer if it belongs to the overload set of td
+static TemplateDeclaration *findOverloadByDecl(::TemplateDeclaration *td, const clang::Decl *D)
+{
+    auto s = getMappedSymbol(D);
+    auto found = s ? s->isTemplateDeclaration() : nullptr;
+    if (!found || !isCPP(found) || overloadRoot(found) != overloadRoot(td))
+        return nullptr;
+
+    auto c_found = static_cast<TemplateDeclaration*>(found);
+    if (c_found->TempOrSpec->getCanonicalDecl() != D->getCanonicalDecl())
+        return nullptr;
+
+    return c_found;
+}
+
 TemplateDeclaration* TemplateDeclaration::primaryTemplate()
 {
     auto Prim = getPrimaryTemplate()->getCanonicalDecl();
 
+    if (auto c_td = findOverloadByDecl(this, Prim))
+        return c_td;
+
     ::TemplateDeclaration *td = this;
     if (td->overroot)
         td = td->overroot;
@@ -604,6 +717,23 @@ clang::NamedDecl* TemplateDeclaration::getClangTemplateInst(Scope* sc, ::Templat
     clang::TemplateArgumentListInfo Args;
     fillTemplateArgumentListInfo(loc, sc, Args, tdtypes, Temp, tymap, expmap);
 
+    // Different D instances (from different modules, or the same arguments spelled differently) may ask for the same
+    // C++ instance, in which case Sema doesn't need to check and substitute the arguments again
+    llvm::FoldingSetNodeID Key;
+    profileTemplateInst(Key, Temp, Args);
+    if (auto FoundInst = findTemplateInst(Key))
+    {
+        calypso.stats.templateInstHits++;
+        if (!FoundInst->Inst)
+            ti->errors = true; // known to fail
+        return FoundInst->Inst;
+    }
+    calypso.stats.templateInstMisses++;
+
+    auto memoize = [&] (clang::NamedDecl *Inst) {
+        return memoizeTemplateInst(Key, Inst);
+    };
+
     clang::TemplateName Name(Temp);
 
     if (isa<clang::ClassTemplateDecl>(Temp) ||
@@ -614,7 +744,7 @@ clang::NamedDecl* TemplateDeclaration::getClangTemplateInst(Scope* sc, ::Templat
 
         auto RT = Ty->castAs<clang::RecordType>();
         auto CTSD = cast<clang::ClassTemplateSpecializationDecl>(RT->getDecl());
-        return CTSD;
+        return memoize(CTSD);
     }
     else if (auto FuncTemp = dyn_cast<clang::FunctionTemplateDecl>(Temp))
     {
@@ -627,13 +757,21 @@ clang::NamedDecl* TemplateDeclaration::getClangTemplateInst(Scope* sc, ::Templat
         {
             Diags.Reset();
             ti->errors = true; // probably an attempt from functionResolve()
-            return nullptr;
+            calypso.stats.templateInstFailures++;
+            return memoize(nullptr);
         }
 
-        // Then the definition
-        S.InstantiateFunctionDefinition(Temp->getLocation(), FuncInst, true);
+        // The definition is left to instantiateFunctionDefinition(), unless the return type needs to be deduced from it
+        if (FuncInst->getReturnType()->isUndeducedType() &&
+                S.DeduceReturnType(FuncInst, Temp->getLocation(), false))
+        {
+            Diags.Reset();
+            ti->errors = true;
+            calypso.stats.templateInstFailures++;
+            return memoize(nullptr);
+        }
 
-        return FuncInst;
+        return memoize(FuncInst);
     }
     else
         assert(false);
@@ -655,6 +793,9 @@ clang::NamedDecl* TemplateDeclaration::getClangTemplateInst(Scope* sc, ::Templat
 
     auto RealTemp = getSpecializedDeclOrExplicit(Spec)->getCanonicalDecl();
 
+    if (auto c_td = findOverloadByDecl(this, RealTemp))
+        return c_td;
+
     ::TemplateDeclaration *td = this;
     if (td->overroot)
         td = td->overroot;
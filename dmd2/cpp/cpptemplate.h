@@ -14,6 +14,7 @@
 namespace clang
 {
 class Decl;
+class FunctionDecl;
 }
 
 namespace cpp
@@ -67,6 +68,8 @@ public:
     void correctTiargs();
 };
 
+void instantiateFunctionDefinition(const clang::FunctionDecl *D);
+
 }
 
 #endif
@@ -1765,7 +1765,7 @@ static clang::Module *GetClangModuleForDecl(const clang::Decl* D)
     if (mod && Key == mod->rootKey)
         return nullptr; // do not import self
 
-    if (!fake && implicitImports[Key])
+    if (!fake && mod->implicitImports[Key])
         return nullptr; // already imported
 
     Identifier *importAliasid = nullptr;
@@ -1804,8 +1804,10 @@ static clang::Module *GetClangModuleForDecl(const clang::Decl* D)
 
     if (!fake)
     {
-        implicitImports[Key] = im;
+        mod->implicitImports[Key] = im;
         mod->members->shift(im);
+        if (mod->symtab)
+            mod->lateImports.push(im); // see Module::processLateImports
     }
 
     return im;
@@ -143,11 +143,11 @@ public:
     clang::QualType toType(Loc loc, Type* t, Scope *sc, StorageClass stc = STCundefined);
     
     ::Import *AddImplicitImportForDecl(Loc loc, const clang::NamedDecl *D, bool fake = false);
+    Module::RootKey GetImplicitImportKeyForDecl(const clang::NamedDecl *D);
 
 protected:
     cpp::Module *mod;
 
-    llvm::SmallDenseMap<Module::RootKey, Import*, 8> implicitImports;
     llvm::DenseMap<const clang::NamedDecl*, Dsymbol*> declMap;  // fast lookup of mirror decls
 
     llvm::SmallVector<const clang::TemplateParameterList*, 4> TempParamScope;
@@ -165,7 +165,6 @@ protected:
 
     ::Import *BuildImplicitImport(Loc loc, const clang::Decl *D, Identifier *aliasid = nullptr);
     ::Import *BuildImplicitImport(Loc loc, const clang::Decl *D, const clang::Module *Mod, Identifier *aliasid = nullptr);
-    Module::RootKey GetImplicitImportKeyForDecl(const clang::NamedDecl *D);
 
     Type *trySubstitute(const clang::Decl *D);
 
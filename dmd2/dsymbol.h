@@ -324,6 +324,7 @@ public:
     FuncDeclaration *findGetMembers();
     virtual Dsymbol *symtabInsert(Dsymbol *s);
     bool hasStaticCtorOrDtor();
+    virtual void completeMembers() {} // CALYPSO: scopes whose members get added on demand add all of them
 
     static size_t dim(Dsymbols *members);
     static Dsymbol *getNth(Dsymbols *members, size_t nth, size_t *pn = NULL);
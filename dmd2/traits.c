@@ -1023,6 +1023,8 @@ Expression *semanticTraits(TraitsExp *e, Scope *sc)
             }
         };
 
+        sds->completeMembers(); // CALYPSO
+
         Identifiers *idents = new Identifiers;
 
         ScopeDsymbol::foreach(sc, sds->members, &PushIdentsDg::dg, idents);
@@ -1041,6 +1043,7 @@ Expression *semanticTraits(TraitsExp *e, Scope *sc)
                     {
                         AggregateDeclaration *ab = (*cd->baseclasses)[i]->base; // CALYPSO WARNING implications?
                         assert(ab);
+                        ab->completeMembers(); // CALYPSO
                         ScopeDsymbol::foreach(NULL, ab->members, &PushIdentsDg::dg, idents);
                         ClassDeclaration *cb = ab->isClassDeclaration();
                         if (cb && cb->baseclasses->dim)
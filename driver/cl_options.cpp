@@ -377,6 +377,12 @@ cl::opt<bool> disableLinkerStripDead(
     cl::desc("Do not try to remove unused symbols during linking"),
     cl::init(false));
 
+cl::opt<unsigned> codegenThreads(
+    "codegen-threads",
+    cl::desc("Optimize and emit the object files of separately compiled "
+             "modules on <n> threads (0 = one per core)"),
+    cl::value_desc("n"), cl::init(1));
+
 cl::opt<bool, true>
     allinst("allinst",
             cl::desc("generate code for all template instantiations"),
@@ -419,9 +425,29 @@ cl::opt<std::string> cppCacheDir("cpp-cachedir",
     cl::value_desc("dir"),
     cl::Prefix);
 
+cl::opt<unsigned> cppCacheKeep("cpp-cachekeep",
+    cl::desc("Number of most recently used Calypso cache entries (configurations and header sets) to keep"),
+    cl::value_desc("n"),
+    cl::init(8));
+
 cl::opt<bool> cppVerboseDiags("cpp-verbosediags",
     cl::desc("Keep Clang diagnostics enabled after the PCH generation. For the time being those are mostly spurious errors from failed instantiations that can be ignored."));
 
+cl::opt<bool> cppChainPCH("cpp-chainpch",
+    cl::desc("Parse the C/C++ headers added by new modmaps into a chained PCH layered on top of the cached one, instead of reparsing every header"));
+
+cl::opt<bool> cppModules("cpp-modules",
+    cl::desc("(experimental) Build the Clang modules described by the .modulemap_d files into separate PCMs, in parallel, and import them instead of reparsing their headers"));
+
+cl::opt<bool> cppMangleCache("cpp-manglecache",
+    cl::desc("Reuse the mangled names of C++ declarations computed by previous compilations loading the same PCH"));
+
+cl::opt<bool> cppInlineBodies("cpp-inline-bodies",
+    cl::desc("When inlining is enabled, emit the inline C++ functions and template instances called from D into the calling module"));
+
+cl::opt<bool> cppStats("cpp-stats",
+    cl::desc("Print statistics about the Calypso PCH cache at the end of the compilation"));
+
 static cl::extrahelp footer(
     "\n"
     "-d-debug can also be specified without options, in which case it enables "
@@ -72,6 +72,7 @@ extern cl::opt<FloatABI::Type> mFloatABI;
 extern cl::opt<bool, true> singleObj;
 extern cl::opt<bool> linkonceTemplates;
 extern cl::opt<bool> disableLinkerStripDead;
+extern cl::opt<unsigned> codegenThreads;
 
 extern cl::opt<BOUNDSCHECK> boundsCheck;
 extern bool nonSafeBoundsChecks;
@@ -81,7 +82,13 @@ extern cl::opt<unsigned, true> nestedTemplateDepth;
 // CALYPSO
 extern cl::list<std::string> cppArgs;
 extern cl::opt<std::string> cppCacheDir;
+extern cl::opt<unsigned> cppCacheKeep;
 extern cl::opt<bool> cppVerboseDiags; // mostly diags from failed instantiations that can be ignored
+extern cl::opt<bool> cppChainPCH;
+extern cl::opt<bool> cppModules;
+extern cl::opt<bool> cppMangleCache;
+extern cl::opt<bool> cppInlineBodies;
+extern cl::opt<bool> cppStats;
 
 // Arguments to -d-debug
 extern std::vector<std::string> debugArgs;
@@ -114,6 +114,8 @@ CodeGenerator::~CodeGenerator() {
 
     writeAndFreeLLModule(filename);
   }
+
+  waitForModuleWriters();
 }
 
 void CodeGenerator::prepareLLModule(Module *m) {
@@ -152,6 +154,7 @@ void CodeGenerator::prepareLLModule(Module *m) {
 void CodeGenerator::finishLLModule(Module *m) {
   for (auto lp: global.langPlugins) // CALYPSO
     lp->codegen()->leaveModule(m, &ir_->module);
+  irModules_.push_back(m);
 
   if (singleObj_) {
     return;
@@ -162,6 +165,9 @@ void CodeGenerator::finishLLModule(Module *m) {
 }
 
 void CodeGenerator::writeAndFreeLLModule(const char *filename) {
+  for (auto lp: global.langPlugins) // CALYPSO
+    lp->codegen()->releaseModule(&ir_->module);
+
   ir_->DBuilder.Finalize();
 
   // Add the linker options metadata flag.
@@ -182,7 +188,14 @@ void CodeGenerator::writeAndFreeLLModule(const char *filename) {
       {llvm::MDString::get(ir_->context(), Version)};
   IdentMetadata->addOperand(llvm::MDNode::get(ir_->context(), IdentNode));
 
-  writeModule(&ir_->module, filename);
+  std::vector<Module *> modules;
+  modules.swap(irModules_);
+  writeModuleAsync(&ir_->module, filename, [modules] {
+    for (auto m : modules) {
+      for (auto lp: global.langPlugins) // CALYPSO
+        lp->codegen()->moduleWritten(m);
+    }
+  });
   global.params.objfiles->push(const_cast<char *>(filename));
   delete ir_;
   ir_ = nullptr;
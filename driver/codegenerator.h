@@ -21,6 +21,7 @@
 #define LDC_DRIVER_CODEGENERATOR_H
 
 #include "gen/irstate.h"
+#include <vector>
 
 namespace ldc {
 
@@ -40,6 +41,7 @@ private:
   bool const singleObj_;
   IRState *ir_;
   const char *firstModuleObjfileName_;
+  std::vector<Module *> irModules_; // the D modules emitted into ir_
 };
 }
 
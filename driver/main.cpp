@@ -29,6 +29,7 @@
 #include "driver/ldc-version.h"
 #include "driver/linker.h"
 #include "driver/targetmachine.h"
+#include "driver/toobj.h"
 #include "gen/cl_helpers.h"
 #include "gen/irstate.h"
 #include "gen/linkage.h"
@@ -1293,11 +1294,17 @@ int main(int argc, char **argv) {
       cg.emit(m);
 
       if (global.errors) {
+        waitForModuleWriters(); // fatal() mustn't exit with writers running
         fatal();
       }
     }
   }
 
+  cpp::calypso.pch.save(); // CALYPSO
+  if (opts::cppStats) {
+    cpp::calypso.printStats();
+  }
+
   // Generate DDoc output files.
   if (global.params.doDocComments) {
     for (unsigned i = 0; i < modules.dim; i++) {
@@ -8,6 +8,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "driver/toobj.h"
+#include "driver/cl_options.h"
 #include "driver/targetmachine.h"
 #include "driver/tool.h"
 #include "gen/irstate.h"
@@ -26,6 +27,9 @@
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/Program.h"
+#if LDC_LLVM_VER >= 308
+#include "llvm/Support/ThreadPool.h"
+#endif
 #if LDC_LLVM_VER >= 307
 #include "llvm/Support/Path.h"
 #endif
@@ -39,6 +43,9 @@
 #include "llvm/IR/Module.h"
 #include <cstddef>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <vector>
 
 static llvm::cl::opt<bool>
     NoIntegratedAssembler("no-integrated-as", llvm::cl::Hidden,
@@ -95,7 +102,7 @@ static void codegenModule(llvm::TargetMachine &Target, llvm::Module &m,
   Passes.run(m);
 }
 
-static void assemble(const std::string &asmpath, const std::string &objpath) {
+static bool assemble(const std::string &asmpath, const std::string &objpath) {
   std::vector<std::string> args;
   args.push_back("-O3");
   args.push_back("-c");
@@ -147,10 +154,7 @@ static void assemble(const std::string &asmpath, const std::string &objpath) {
   // Run the compiler to assembly the program.
   std::string gcc(getGcc());
   int R = executeToolAndWait(gcc, args, global.params.verbose);
-  if (R) {
-    error(Loc(), "Error while invoking external assembler.");
-    fatal();
-  }
+  return R == 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -334,9 +338,12 @@ public:
 };
 } // end of anonymous namespace
 
-void writeModule(llvm::Module *m, std::string filename) {
+// Returns the error message, or an empty string if the files were written.
+// This may run on a worker thread, so errors aren't reported from here.
+static std::string writeModule(llvm::TargetMachine &target, llvm::Module *m,
+                               const std::string &filename) {
   // run optimizer
-  ldc_optimize_module(m);
+  ldc_optimize_module(m, target);
 
   // There is no integrated assembler on AIX because XCOFF is not supported.
   // Starting with LLVM 3.5 the integrated assembler can be used with MinGW.
@@ -364,9 +371,8 @@ void writeModule(llvm::Module *m, std::string filename) {
     ErrorInfo errinfo;
     llvm::raw_fd_ostream bos(bcpath.c_str(), errinfo, llvm::sys::fs::F_None);
     if (bos.has_error()) {
-      error(Loc(), "cannot write LLVM bitcode file '%s': %s", bcpath.c_str(),
-            ERRORINFO_STRING(errinfo));
-      fatal();
+      return std::string("cannot write LLVM bitcode file '") + bcpath.c_str() +
+             "': " + ERRORINFO_STRING(errinfo);
     }
     llvm::WriteBitcodeToFile(m, bos);
   }
@@ -379,9 +385,8 @@ void writeModule(llvm::Module *m, std::string filename) {
     ErrorInfo errinfo;
     llvm::raw_fd_ostream aos(llpath.c_str(), errinfo, llvm::sys::fs::F_None);
     if (aos.has_error()) {
-      error(Loc(), "cannot write LLVM asm file '%s': %s", llpath.c_str(),
-            ERRORINFO_STRING(errinfo));
-      fatal();
+      return std::string("cannot write LLVM asm file '") + llpath.c_str() +
+             "': " + ERRORINFO_STRING(errinfo);
     }
     AssemblyAnnotator annotator;
     m->print(aos, &annotator);
@@ -405,16 +410,16 @@ void writeModule(llvm::Module *m, std::string filename) {
       if (errinfo.empty())
 #endif
       {
-        codegenModule(*gTargetMachine, *m, out,
+        codegenModule(target, *m, out,
                       llvm::TargetMachine::CGFT_AssemblyFile);
       } else {
-        error(Loc(), "cannot write native asm: %s", ERRORINFO_STRING(errinfo));
-        fatal();
+        return std::string("cannot write native asm: ") +
+               ERRORINFO_STRING(errinfo);
       }
     }
 
-    if (assembleExternally) {
-      assemble(spath.str(), filename);
+    if (assembleExternally && !assemble(spath.str(), filename)) {
+      return "Error while invoking external assembler.";
     }
 
     if (!global.params.output_s) {
@@ -434,14 +439,134 @@ void writeModule(llvm::Module *m, std::string filename) {
       if (errinfo.empty())
 #endif
       {
-        codegenModule(*gTargetMachine, *m, out,
+        codegenModule(target, *m, out,
                       llvm::TargetMachine::CGFT_ObjectFile);
       } else {
-        error(Loc(), "cannot write object file: %s", ERRORINFO_STRING(errinfo));
-        fatal();
+        return std::string("cannot write object file: ") +
+               ERRORINFO_STRING(errinfo);
       }
     }
   }
 
 #undef ERRORINFO_STRING
+  return std::string();
+}
+
+void writeModule(llvm::Module *m, std::string filename) {
+  auto errorMessage = writeModule(*gTargetMachine, m, filename);
+  if (!errorMessage.empty()) {
+    error(Loc(), "%s", errorMessage.c_str());
+    fatal();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if LDC_LLVM_VER >= 308
+namespace {
+// -codegen-threads: finished modules are handed over as bitcode to the worker
+// threads, which parse them into their own LLVMContext while the IR of the next
+// modules gets generated.
+std::unique_ptr<llvm::ThreadPool> writerPool;
+thread_local std::unique_ptr<llvm::TargetMachine> writerTarget;
+
+// Filled by the worker, then reported by waitForModuleWriters() on the main
+// thread.
+struct PendingWrite {
+  std::string filename;
+  std::string errorMessage;
+  std::function<void()> onWritten;
+};
+std::vector<std::shared_ptr<PendingWrite>> pendingWrites;
+
+llvm::TargetMachine *createWriterTargetMachine() {
+  auto &tm = *gTargetMachine;
+  return tm.getTarget().createTargetMachine(
+      tm.getTargetTriple().str(), tm.getTargetCPU(),
+      tm.getTargetFeatureString(), tm.Options, tm.getRelocationModel(),
+      tm.getCodeModel(), tm.getOptLevel());
+}
+}
+#endif
+
+void writeModuleAsync(llvm::Module *m, std::string filename,
+                      std::function<void()> onWritten) {
+#if LDC_LLVM_VER >= 308
+  // The logger isn't thread-safe
+  if (opts::codegenThreads != 1 && !Logger::enabled()) {
+    if (!writerPool) {
+      writerPool.reset(opts::codegenThreads
+                           ? new llvm::ThreadPool(opts::codegenThreads)
+                           : new llvm::ThreadPool);
+    }
+
+    auto bitcode = std::make_shared<llvm::SmallVector<char, 0>>();
+    {
+      llvm::raw_svector_ostream os(*bitcode);
+      llvm::WriteBitcodeToFile(m, os);
+    }
+
+    auto pending = std::make_shared<PendingWrite>();
+    pending->filename = filename;
+    pending->onWritten = std::move(onWritten);
+    pendingWrites.push_back(pending);
+
+    writerPool->async([bitcode, pending] {
+      if (!writerTarget) {
+        writerTarget.reset(createWriterTargetMachine());
+      }
+
+      llvm::LLVMContext context;
+      auto mod = llvm::parseBitcodeFile(
+          llvm::MemoryBufferRef(
+              llvm::StringRef(bitcode->data(), bitcode->size()),
+              pending->filename),
+          context);
+      if (!mod) {
+        pending->errorMessage = "cannot reload the LLVM module of '" +
+                                pending->filename +
+                                "': " + mod.getError().message();
+        return;
+      }
+
+      pending->errorMessage =
+          writeModule(*writerTarget, mod.get().get(), pending->filename);
+    });
+    return;
+  }
+#endif
+
+  // Without llvm::ThreadPool (LLVM < 3.8), -codegen-threads is ignored
+  writeModule(m, filename);
+  if (onWritten) {
+    onWritten();
+  }
+}
+
+void waitForModuleWriters() {
+#if LDC_LLVM_VER >= 308
+  if (!writerPool) {
+    return;
+  }
+
+  writerPool->wait();
+  writerPool.reset(); // joins the workers, destroying their TargetMachine
+
+  auto writes = std::move(pendingWrites);
+  pendingWrites.clear();
+
+  bool failed = false;
+  for (auto &pending : writes) {
+    if (!pending->errorMessage.empty()) {
+      error(Loc(), "%s", pending->errorMessage.c_str());
+      failed = true;
+    } else if (pending->onWritten) {
+      pending->onWritten();
+    }
+  }
+
+  if (failed) {
+    fatal();
+  }
+#endif
 }
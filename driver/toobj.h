@@ -14,6 +14,7 @@
 #ifndef LDC_DRIVER_TOOBJ_H
 #define LDC_DRIVER_TOOBJ_H
 
+#include <functional>
 #include <string>
 
 namespace llvm {
@@ -22,4 +23,15 @@ class Module;
 
 void writeModule(llvm::Module *m, std::string filename);
 
+// Same as writeModule, but with -codegen-threads the optimization and emission
+// run on a worker thread. m isn't referenced anymore once this returns.
+// onWritten is called on the main thread once the files were successfully
+// written, which may be as late as waitForModuleWriters().
+void writeModuleAsync(llvm::Module *m, std::string filename,
+                      std::function<void()> onWritten);
+
+// Waits until every module passed to writeModuleAsync has been written, then
+// reports the errors of the worker threads.
+void waitForModuleWriters();
+
 #endif
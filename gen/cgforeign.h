@@ -17,6 +17,8 @@ class ForeignCodeGen
 public:
     virtual void enterModule(::Module *m, llvm::Module *lm) = 0;
     virtual void leaveModule(::Module *m, llvm::Module *lm) = 0;
+    virtual void releaseModule(llvm::Module *lm) = 0; // lm is complete and about to be written (may span several D modules with -singleobj)
+    virtual void moduleWritten(::Module *m) = 0; // the llvm::Module m was emitted into has been written
 
     virtual void enterFunc(FuncDeclaration *fd) = 0;
     virtual void leaveFunc() = 0;
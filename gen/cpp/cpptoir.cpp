@@ -6,10 +6,12 @@
 
 #include "mtype.h"
 #include "target.h"
+#include "driver/cl_options.h"
 #include "gen/dvalue.h"
 #include "gen/functions.h"
 #include "gen/logger.h"
 #include "gen/irstate.h"
+#include "gen/optimizer.h"
 #include "gen/classes.h"
 #include "ir/irfunction.h"
 #include "gen/llvmhelpers.h"
@@ -38,6 +40,7 @@
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
+#include <chrono>
 #include <memory>
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -51,29 +54,45 @@ using llvm::isa;
 
 namespace clangCG = clang::CodeGen;
 
+static bool emitInlineBodies()
+{
+    return opts::cppInlineBodies && willInline();
+}
+
 void LangPlugin::enterModule(::Module *, llvm::Module *lm)
 {
     auto AST = getASTUnit();
     if (!AST)
         return;
 
-    pch.save(); // save the numerous instantiations done by DMD back into the PCH
+    // With -singleobj every D module is emitted into the same llvm::Module and through the same CodeGenModule
+    assert(!CGM && "CodeGenModule of the previous llvm::Module wasn't released");
 
+    auto setupStart = std::chrono::steady_clock::now();
     auto& Context = getASTContext();
 
-    auto Opts = new clang::CodeGenOptions;
-    if (global.params.symdebug)
-        Opts->setDebugInfo(clang::CodeGenOptions::FullDebugInfo);
+    if (!CGOpts)
+    {
+        CGOpts.reset(new clang::CodeGenOptions);
+        if (global.params.symdebug)
+            CGOpts->setDebugInfo(clang::CodeGenOptions::FullDebugInfo);
+        if (emitInlineBodies())
+            CGOpts->OptimizationLevel = codeGenOptLevel(); // otherwise Clang skips the available_externally functions
+    }
 
     CGM.reset(new clangCG::CodeGenModule(Context,
                             AST->getPreprocessor().getHeaderSearchInfo().getHeaderSearchOpts(),
                             AST->getPreprocessor().getPreprocessorOpts(),
-                            *Opts, *lm, *pch.Diags));
+                            *CGOpts, *lm, *pch.Diags));
     if (!RecordDeclTypes.empty())
         // restore the CodeGenTypes state, to prevent Clang from recreating types that end up different from the ones LDC knows
         CGM->getTypes().swapTypeCache(CGRecordLayouts, RecordDeclTypes, TypeCache);
 
     type_infoWrappers.clear();
+
+    std::chrono::duration<double> setupTime = std::chrono::steady_clock::now() - setupStart;
+    stats.codegenModules++;
+    stats.codegenSetupTime += setupTime.count();
 }
 
 void removeDuplicateModuleFlags(llvm::Module *lm)
@@ -117,11 +136,33 @@ void removeDuplicateModuleFlags(llvm::Module *lm)
     }
 }
 
-void LangPlugin::leaveModule(::Module *m, llvm::Module *lm)
+void LangPlugin::leaveModule(::Module *m, llvm::Module *)
 {
     if (!getASTUnit())
         return;
 
+    stats.codegenDModules++;
+}
+
+// Only complete object files may be reused, i.e once the CodeGenModule was released and its llvm::Module written
+void LangPlugin::moduleWritten(::Module *m)
+{
+    if (!getASTUnit())
+        return;
+
+    if (!global.errors && isCPP(m))
+        calypso.genModSet.add(m);
+}
+
+// Deferred decls, vtables, RTTI and global structors are emitted once per llvm::Module
+void LangPlugin::releaseModule(llvm::Module *lm)
+{
+    if (!CGM)
+        return;
+
+    assert(&CGM->getModule() == lm);
+    auto releaseStart = std::chrono::steady_clock::now();
+
     // HACK temporarily rename the @llvm.global_ctors and @llvm.global_dtors variables created by LDC,
     // because CodeGenModule::Release will assume that they do not exist and use the same name, which LLVM will change to an unused one.
     auto ldcCtor = lm->getNamedGlobal("llvm.global_ctors"),
@@ -180,8 +221,8 @@ void LangPlugin::leaveModule(::Module *m, llvm::Module *lm)
     CGM->getTypes().swapTypeCache(CGRecordLayouts, RecordDeclTypes, TypeCache); // save the CodeGenTypes state
     CGM.reset();
 
-    if (!global.errors && isCPP(m))
-        calypso.genModSet.add(m);
+    std::chrono::duration<double> releaseTime = std::chrono::steady_clock::now() - releaseStart;
+    stats.codegenReleaseTime += releaseTime.count();
 }
 
 void LangPlugin::enterFunc(::FuncDeclaration *fd)
@@ -265,10 +306,19 @@ struct ResolvedFunc
         const clang::FunctionDecl *Def;
 
         // If this is a always inlined function, emit it in any module calling or referencing it
-        if (result.Func->isDeclaration() && FD->hasBody(Def) &&
+        // With -cpp-inline-bodies do the same for every inline function and template instance, so that the inliner
+        // may flatten calls from D. Clang gives them linkonce_odr linkage, or available_externally if they're
+        // covered by an extern template.
+        bool emitBody = FD->hasAttr<clang::AlwaysInlineAttr>();
+        if (!emitBody && emitInlineBodies() && (FD->isInlined() || FD->isTemplateInstantiation()))
+        {
+            instantiateFunctionDefinition(FD);
+            emitBody = true;
+        }
+
+        if (emitBody && result.Func->isDeclaration() && FD->hasBody(Def) &&
                 FPT->getExceptionSpecType() != clang::EST_Unevaluated)
-            if (FD->hasAttr<clang::AlwaysInlineAttr>())
-                CGM.EmitTopLevelDecl(const_cast<clang::FunctionDecl*>(Def));
+            CGM.EmitTopLevelDecl(const_cast<clang::FunctionDecl*>(Def));
 
         return result;
     }
@@ -715,6 +765,7 @@ void LangPlugin::toDefineFunction(::FuncDeclaration* fdecl)
     auto FD = getFD(fdecl);
     const clang::FunctionDecl *Def;
 
+    instantiateFunctionDefinition(FD);
     if (FD->hasBody(Def) && getIrFunc(fdecl)->func->isDeclaration())
         CGM->EmitTopLevelDecl(const_cast<clang::FunctionDecl*>(Def)); // TODO remove const_cast
 }
@@ -832,12 +883,26 @@ static void EmitUnmappedRecordMethods(clangCG::CodeGenModule& CGM,
     auto Emit = [&] (clang::CXXMethodDecl *D) {
         if (D && !D->isDeleted())
         {
+            MarkFunctionForEmit(D); // implicit members of records with lazy members may not be defined yet
             auto R = ResolvedFunc::get(CGM, D); // mark it used
             if (R.Func->isDeclaration())
                 CGM.EmitTopLevelDecl(D); // mark it emittable
         }
     };
 
+    // Methods of records with lazy members that D code never looked up weren't mapped
+    if (hasLazyMembers(RD))
+        for (auto MD: RD->methods())
+        {
+            if (!isLazyRecordMember(MD) || !isMapped(MD))
+                continue;
+
+            MarkFunctionForEmit(MD); // instantiates the body of template instance methods
+            const clang::FunctionDecl *Def;
+            if (MD->hasBody(Def))
+                Emit(cast<clang::CXXMethodDecl>(const_cast<clang::FunctionDecl*>(Def)));
+        }
+
     Emit(S.LookupDefaultConstructor(RD));
     for (int i = 0; i < 2; i++)
         Emit(S.LookupCopyingConstructor(RD, i ? clang::Qualifiers::Const : 0));
@@ -37,7 +37,6 @@
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 
-extern llvm::TargetMachine *gTargetMachine;
 using namespace llvm;
 
 static cl::opt<signed char> optimizeLevel(
@@ -300,7 +299,7 @@ static void addOptimizationPasses(PassManagerBase &mpm,
 ////////////////////////////////////////////////////////////////////////////////
 // This function runs optimization passes based on command line arguments.
 // Returns true if any optimization passes were invoked.
-bool ldc_optimize_module(llvm::Module *M) {
+bool ldc_optimize_module(llvm::Module *M, llvm::TargetMachine &target) {
 // Create a PassManager to hold and optimize the collection of
 // per-module passes we are about to build.
 #if LDC_LLVM_VER >= 307
@@ -348,10 +347,10 @@ bool ldc_optimize_module(llvm::Module *M) {
 #if LDC_LLVM_VER >= 307
   // Add internal analysis passes from the target machine.
   mpm.add(createTargetTransformInfoWrapperPass(
-      gTargetMachine->getTargetIRAnalysis()));
+      target.getTargetIRAnalysis()));
 #else
   // Add internal analysis passes from the target machine.
-  gTargetMachine->addAnalysisPasses(mpm);
+  target.addAnalysisPasses(mpm);
 #endif
 
 // Also set up a manager for the per-function passes.
@@ -363,13 +362,13 @@ bool ldc_optimize_module(llvm::Module *M) {
 #if LDC_LLVM_VER >= 307
   // Add internal analysis passes from the target machine.
   fpm.add(createTargetTransformInfoWrapperPass(
-      gTargetMachine->getTargetIRAnalysis()));
+      target.getTargetIRAnalysis()));
 #elif LDC_LLVM_VER >= 306
   fpm.add(new DataLayoutPass());
-  gTargetMachine->addAnalysisPasses(fpm);
+  target.addAnalysisPasses(fpm);
 #else
                                     fpm.add(new DataLayoutPass(M));
-                                    gTargetMachine->addAnalysisPasses(fpm);
+                                    target.addAnalysisPasses(fpm);
 #endif
 
   // If the -strip-debug command line option was specified, add it before
@@ -34,9 +34,10 @@ extern llvm::cl::opt<SanitizerCheck> sanitize;
 
 namespace llvm {
 class Module;
+class TargetMachine;
 }
 
-bool ldc_optimize_module(llvm::Module *m);
+bool ldc_optimize_module(llvm::Module *m, llvm::TargetMachine &target);
 
 // Returns whether the normal, full inlining pass will be run.
 bool willInline();
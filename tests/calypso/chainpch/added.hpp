@@ -0,0 +1,17 @@
+#pragma once
+
+#include "base.hpp"
+
+namespace chain
+{
+    // Refers to types and template instances of the base layer
+    inline int squaredLength(const Vec &v) { return v.dot(v); }
+
+    inline Box<Vec> boxed(const Vec &v) { Box<Vec> b = { v }; return b; }
+
+    struct Segment
+    {
+        Vec a, b;
+        int dx() const { return b.x - a.x; }
+    };
+}
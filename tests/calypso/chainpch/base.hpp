@@ -0,0 +1,19 @@
+#pragma once
+
+namespace chain
+{
+    struct Vec
+    {
+        int x, y;
+
+        Vec(int x, int y) : x(x), y(y) {}
+        int dot(const Vec &o) const { return x * o.x + y * o.y; }
+    };
+
+    template<typename T>
+    struct Box
+    {
+        T value;
+        T get() const { return value; }
+    };
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+
+set -e
+
+/bin/rm -rf calypso* chainpch chainpch_base *.o
+
+# Base layer
+ldc2 -cpp-chainpch chainpch_base.d
+# added.hpp gets parsed into a chained layer
+ldc2 -v -cpp-chainpch -L-lstdc++ chainpch.d | grep cpp-pch
+# The chain gets reloaded
+ldc2 -cpp-chainpch -L-lstdc++ chainpch.d
+./chainpch
+
+/bin/rm *.o
+/bin/rm -rf calypso*